@@ -0,0 +1,119 @@
+#include "benchmark.h"
+#include "../model/air_solver.h"
+#include "../model/constant.h"
+#include "../model/utility.h"
+#include "../common/parallel.h"
+#include <cstdio>
+
+using namespace Simflow;
+
+// 以确定的随机速度场初始化，保证各次运行的输入一致
+static void fill_random_flow(AirSolver& solver, int seed) {
+    solver.reset();
+    for (int i = 0; i < solver.getTotSize(); i++) {
+        solver.getVX()[i] = hash_random(hash_combine(seed, i), -20.f, 20.f);
+        solver.getVY()[i] = hash_random(hash_combine(seed + 1, i), -20.f, 20.f);
+        solver.getD()[i] = hash_random(hash_combine(seed + 2, i), 0.f, 1.f);
+    }
+}
+
+// 每帧一次 animVel + animDen 的耗时，网格从 128² 到 2048²；最后一列为在线程池上按行带并行的整步耗时
+BENCHMARK(air_solver_step) {
+    Parallel pool;
+    printf("%8s %12s %12s %12s %14s %14s\n", "grid", "animVel ms", "animDen ms", "step ms", "ns / cell", "pooled ms");
+    for (int n = 128; n <= 2048; n *= 2) {
+        AirSolver solver;
+        solver.init(n, n, K_DT);
+        fill_random_flow(solver, n);
+        float vel = measure_ms([&] { solver.animVel(); });
+        float den = measure_ms([&] { solver.animDen(); });
+        float step = vel + den;
+        fill_random_flow(solver, n);
+        solver.setParallel(&pool);
+        float pooled = measure_ms([&] { solver.animVel(); solver.animDen(); });
+        printf("%6d^2 %12.3f %12.3f %12.3f %14.2f %14.3f\n", n, vel, den, step, step * 1e6f / (float(n) * n), pooled);
+    }
+}
+
+// 静止大网格中央 16×16 的区域每帧注入速度（模拟少量运动的粒子）：整网格求解与只解活跃区域的每帧 animVel 耗时
+BENCHMARK(air_solver_active_region) {
+    printf("%8s %12s %12s %14s\n", "grid", "full ms", "active ms", "active cells");
+    for (int n = 256; n <= 2048; n *= 2) {
+        float ms[2];
+        int cells = 0;
+        for (int mode = 0; mode < 2; mode++) {
+            AirSolver solver;
+            solver.init(n, n, K_DT);
+            solver.setPressureSolver(PRESSURE_MULTIGRID, K_AIR_PRESSURE_CYCLES, K_AIR_PRESSURE_TOLERANCE);
+            solver.reset();
+            if (mode == 1) solver.setActiveTiles(K_AIR_TILE, K_AIR_SLEEP_VELOCITY);
+            int frame = 0;
+            auto step = [&] {
+                for (int j = n / 2 - 8; j < n / 2 + 8; j++) {
+                    for (int i = n / 2 - 8; i < n / 2 + 8; i++) {
+                        int index = j * n + i;
+                        solver.getVX()[index] += hash_random(hash_combine(frame, index), -2.f, 2.f);
+                        solver.getVY()[index] += hash_random(hash_combine(frame + 1, index), -2.f, 2.f);
+                        solver.wake(index);
+                    }
+                }
+                solver.animVel();
+                frame++;
+            };
+            // 先运行若干帧，使流场与活跃区域进入稳态
+            for (int f = 0; f < 30; f++) step();
+            ms[mode] = measure_ms(step);
+            if (mode == 1) cells = solver.activeCells;
+        }
+        printf("%6d^2 %12.3f %12.3f %14d\n", n, ms[0], ms[1], cells);
+    }
+}
+
+// 有墙的场景：竖直隔墙与若干实心块，左侧持续注入向右的气流。
+// 不带掩码时像 compute_air_flow 原先那样每帧把固体格速度清零，带掩码时交给 AirSolver::setSolid；
+// 比较每帧 animVel 耗时与每帧压力迭代次数
+BENCHMARK(air_solver_solid_mask) {
+    printf("%8s %8s %12s %12s %12s\n", "grid", "mask", "ms", "iterations", "residual");
+    for (int n = 128; n <= 1024; n *= 2) {
+        vector<unsigned char> solid(n * n, 0);
+        for (int j = n / 8; j < n - n / 8; j++) {
+            for (int i = n / 2; i < n / 2 + n / 32; i++) solid[j * n + i] = 1;
+        }
+        for (int k = 0; k < 12; k++) {
+            int x = int(hash_random(hash_combine(n, k), 1.f, n * 0.8f));
+            int y = int(hash_random(hash_combine(n + 1, k), 1.f, n * 0.8f));
+            int w = int(hash_random(hash_combine(n + 2, k), 2.f, n / 6.f));
+            int h = int(hash_random(hash_combine(n + 3, k), 2.f, n / 6.f));
+            for (int j = y; j < y + h && j < n - 1; j++) {
+                for (int i = x; i < x + w && i < n - 1; i++) solid[j * n + i] = 1;
+            }
+        }
+        for (int mask = 0; mask < 2; mask++) {
+            AirSolver solver;
+            solver.init(n, n, K_DT);
+            solver.setPressureSolver(PRESSURE_MULTIGRID, K_AIR_PRESSURE_CYCLES, K_AIR_PRESSURE_TOLERANCE);
+            solver.reset();
+            if (mask) solver.setSolid(solid.data());
+            int frame = 0, iterations = 0;
+            auto step = [&] {
+                for (int j = n / 4; j < n - n / 4; j++) {
+                    int index = j * n + n / 16;
+                    if (!solid[index]) solver.getVX()[index] += 1.f + hash_random(hash_combine(frame, index), 0.f, 1.f);
+                }
+                if (!mask) {
+                    for (int i = 0; i < n * n; i++) {
+                        if (solid[i]) solver.getVX()[i] = solver.getVY()[i] = 0.f;
+                    }
+                }
+                solver.animVel();
+                iterations += solver.pressureIterationsRun;
+                frame++;
+            };
+            // 先运行若干帧，使流场进入稳态
+            for (int f = 0; f < 30; f++) step();
+            iterations = frame = 0;
+            float ms = measure_ms(step);
+            printf("%6d^2 %8s %12.3f %12.2f %12.2e\n", n, mask ? "on" : "off", ms, float(iterations) / frame, solver.pressureResidual);
+        }
+    }
+}
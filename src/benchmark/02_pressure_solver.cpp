@@ -0,0 +1,90 @@
+#include "benchmark.h"
+#include "../model/pressure_solver.h"
+#include "../model/utility.h"
+#include <cstdio>
+#include <cmath>
+
+using namespace Simflow;
+
+// 各压力求解器从 p = 0 出发，不同迭代次数下的耗时与相对残差，用于按网格大小选择求解器
+// wallScale = 0.95 与 AirSolver 一致；DCT 只对 wallScale = 1（封闭空盒）精确，另列一行
+BENCHMARK(pressure_solver_residual) {
+    struct Config {
+        const char* name;
+        PressureSolverType type;
+        vector<int> iterations;
+    };
+    vector<Config> configs = {
+        { "jacobi", PRESSURE_JACOBI, { 10, 20, 50, 100, 200 } },
+        { "multigrid", PRESSURE_MULTIGRID, { 1, 2, 3, 5, 8 } },
+        { "pcg", PRESSURE_PCG, { 5, 10, 20, 50, 100 } },
+        { "dct", PRESSURE_DCT, { 1 } },
+    };
+
+    printf("%8s %-18s %10s %12s %12s\n", "grid", "solver", "iters", "ms", "residual");
+    for (int n = 128; n <= 2048; n *= 2) {
+        vector<float> div(n * n, 0.f), p(n * n);
+        double mean = 0, square = 0;
+        for (int j = 1; j < n - 1; j++) {
+            for (int i = 1; i < n - 1; i++) {
+                div[j * n + i] = hash_random(hash_combine(n, j * n + i), -1.f, 1.f);
+                mean += div[j * n + i];
+                square += div[j * n + i] * div[j * n + i];
+            }
+        }
+        mean /= double(n - 2) * (n - 2);
+        // 残差按 div 的均方根归一化
+        float div_rms = float(sqrt(square / (double(n - 2) * (n - 2))));
+
+        for (auto& config : configs) {
+            PressureSolver* solver = PressureSolver::create(config.type);
+            solver->init(n, n, 0.95f);
+            for (int iterations : config.iterations) {
+                float ms = measure_ms([&] {
+                    fill(p.begin(), p.end(), 0.f);
+                    solver->solve(p.data(), div.data(), iterations, 0.f);
+                }, 50, 1);
+                printf("%6d^2 %-18s %10d %12.3f %12.2e\n", n, config.name, iterations, ms, solver->lastResidual / div_rms);
+            }
+            delete solver;
+        }
+
+        // 封闭空盒：wallScale = 1，右端项去掉均值使方程有解
+        vector<float> div_closed = div;
+        for (int j = 1; j < n - 1; j++) {
+            for (int i = 1; i < n - 1; i++) div_closed[j * n + i] -= float(mean);
+        }
+        PressureSolver* dct = PressureSolver::create(PRESSURE_DCT);
+        dct->init(n, n, 1.f);
+        float ms = measure_ms([&] {
+            fill(p.begin(), p.end(), 0.f);
+            dct->solve(p.data(), div_closed.data(), 1, 0.f);
+        }, 50, 1);
+        printf("%6d^2 %-18s %10d %12.3f %12.2e\n", n, "dct (closed box)", 1, ms, dct->lastResidual / div_rms);
+        delete dct;
+    }
+}
+
+// 20 次 Jacobi 迭代：逐次扫过整个网格与 gridJacobiSweeps 的时间分块（结果逐位相同）
+BENCHMARK(jacobi_sweeps) {
+    const int sweeps = 20;
+    const float walls[4] = { 0.95f, 0.95f, 0.95f, 0.95f };
+    printf("%8s %12s %12s %10s\n", "grid", "plain ms", "blocked ms", "speedup");
+    for (int n = 128; n <= 2048; n *= 2) {
+        vector<float> rhs(n * n), p(n * n, 0.f), tmp(n * n, 0.f), scratch;
+        for (int i = 0; i < n * n; i++) rhs[i] = hash_random(hash_combine(n, i), -1.f, 1.f);
+        float plain = measure_ms([&] {
+            float* src = p.data();
+            float* dst = tmp.data();
+            for (int k = 0; k < sweeps; k++) {
+                gridJacobi(dst, src, rhs.data(), -1.f, 1.f, 0.25f, n, n);
+                gridBoundary(dst, n, n, 0.95f);
+                swap(src, dst);
+            }
+        });
+        float blocked = measure_ms([&] {
+            gridJacobiSweeps(p.data(), tmp.data(), rhs.data(), -1.f, 1.f, 0.25f, walls, n, n, sweeps, scratch);
+        });
+        printf("%6d^2 %12.3f %12.3f %10.2f\n", n, plain, blocked, plain / blocked);
+    }
+}
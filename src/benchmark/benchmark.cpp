@@ -0,0 +1,15 @@
+#include "benchmark.h"
+vector<pair<string, void(*)()>> benchmarks;
+
+using namespace std;
+
+// 不带参数时运行全部基准，否则只运行名字包含该参数的基准
+int main(int argc, char** argv) {
+    string filter = argc > 1 ? argv[1] : "";
+    for (auto& p : benchmarks) {
+        if (p.first.find(filter) == string::npos) continue;
+        cout << "== " << p.first << " ==" << endl;
+        p.second();
+    }
+    return 0;
+}
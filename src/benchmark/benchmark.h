@@ -0,0 +1,22 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <iostream>
+#include "../common/timer.h"
+
+using namespace std;
+extern vector<pair<string, void(*)()>> benchmarks;
+
+// 重复运行 fn 直到累计超过 min_ms（至少 min_runs 次），返回单次平均耗时（毫秒）
+template<typename F>
+float measure_ms(F&& fn, float min_ms = 200, int min_runs = 3) {
+    Simflow::Timer timer;
+    int runs = 0;
+    do {
+        fn();
+        runs++;
+    } while (runs < min_runs || timer.ms() < min_ms);
+    return timer.ms() / runs;
+}
+
+#define BENCHMARK(name) void name(); static auto b_##name = benchmarks.insert(benchmarks.end(), pair<string, void(*)()>(#name, name)); void name()
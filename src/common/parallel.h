@@ -1,113 +1,319 @@
 #pragma once
 #include <functional>
 #include <vector>
-#include <queue>
+#include <deque>
 #include <thread>
 #include <iostream>
 #include <condition_variable>
+#include <mutex>
 #include <memory> //unique_ptr
 #include <atomic>
 #include <stdexcept>
-#define N_WORKERS 4
 
 namespace Simflow {
     using namespace std;
 
+    // ȡ̳߳
+    // ÿ߳ӵԼ˫˶УԼβȡLIFO̴߳ͷȡFIFO
+    // ȴɵ̣߳߳Эִ˸ӿڶǶ׵
     class Parallel {
 
     private:
 
-        struct Workload {
-            function<void()> work;
-            function<void()> on_finish;
+        // һ񣺶 ctx ִ run(ctx, lo, hi)[lo, hi) Ϊֿ±
+        // ִʱֿ1԰ֲҰ벿ַŻضй߳ȡ
+        struct Task {
+            void (*run)(void* ctx, int lo, int hi) = nullptr;
+            void* ctx = nullptr;
+            int lo = 0, hi = 0;
+            atomic<int>* pending = nullptr;
         };
 
-        std::vector<std::thread> work_threads;
-        std::queue<Workload>task_queue;;
-        std::mutex queue_mutex;
-        std::condition_variable condition;
-        bool stop;
+        struct WorkQueue {
+            mutex mtx;
+            deque<Task> tasks;
+        };
+
+        vector<thread> work_threads;
+        vector<unique_ptr<WorkQueue>> queues;
 
-        int count;
+        mutex sleep_mutex;
+        condition_variable sleep_cv;
+        atomic<int> n_queued{ 0 };
+        atomic<int> n_sleeping{ 0 };
+        atomic<unsigned int> next_queue{ 0 };
+        bool stop = false;
+
+        inline static thread_local Parallel* tls_pool = nullptr;
+        inline static thread_local int tls_index = -1;
 
     private:
 
-        static void* worker(void* arg) {
-            Parallel* pool = (Parallel*)arg;
-            pool->run();
-            return pool;
+        int current_queue() {
+            if (tls_pool == this) return tls_index;
+            return int(next_queue++ % queues.size());
         }
 
-        void run() {
-            while (!stop)
+        void push(const Task& t) {
+            WorkQueue& q = *queues[current_queue()];
             {
-                Workload wl;
-
-                {
-                    std::unique_lock<std::mutex> lk(this->queue_mutex);
-                    /*unique_lock() Զ*/
-
-                    this->condition.wait(lk, [this] { return !this->task_queue.empty(); });
-                    //Ϊգͣȴ
-
-                    if (this->task_queue.empty())
-                    {
-                        continue;
-                    }
-                    else
-                    {
-                        wl = task_queue.front();
-                        task_queue.pop();
-                    }
+                lock_guard lg(q.mtx);
+                q.tasks.push_back(t);
+            }
+            n_queued++;
+            if (n_sleeping > 0) {
+                lock_guard lg(sleep_mutex);
+                sleep_cv.notify_one();
+            }
+        }
+
+        // ȡԼβ񣬷ͷȡ
+        bool pop(Task& t) {
+            int n = int(queues.size());
+            int self = tls_pool == this ? tls_index : -1;
+            if (self >= 0) {
+                WorkQueue& q = *queues[self];
+                lock_guard lg(q.mtx);
+                if (!q.tasks.empty()) {
+                    t = q.tasks.back();
+                    q.tasks.pop_back();
+                    n_queued--;
+                    return true;
                 }
-                wl.work();
-                wl.on_finish();
             }
+            int start = self >= 0 ? self + 1 : 0;
+            for (int i = 0; i < n; i++) {
+                WorkQueue& q = *queues[(start + i) % n];
+                lock_guard lg(q.mtx);
+                if (!q.tasks.empty()) {
+                    t = q.tasks.front();
+                    q.tasks.pop_front();
+                    n_queued--;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void execute(Task t) {
+            while (t.hi - t.lo > 1) {
+                int mid = (t.lo + t.hi) / 2;
+                Task right = t;
+                right.lo = mid;
+                t.hi = mid;
+                (*t.pending)++;
+                push(right);
+            }
+            t.run(t.ctx, t.lo, t.hi);
+            (*t.pending)--;
+        }
+
+        // Ӷȡһڵǰִ߳Уûпִеʱfalse
+        bool run_one() {
+            Task t;
+            if (!pop(t)) return false;
+            execute(t);
+            return true;
+        }
+
+        // ȴ㣬ڼЭִ
+        void wait(atomic<int>& pending) {
+            while (pending > 0) {
+                if (!run_one()) this_thread::yield();
+            }
+        }
+
+        void run(int index) {
+            tls_pool = this;
+            tls_index = index;
+            while (true) {
+                if (run_one()) continue;
 
+                unique_lock lk(sleep_mutex);
+                if (stop) break;
+                n_sleeping++;
+                sleep_cv.wait(lk, [this] { return stop || n_queued > 0; });
+                n_sleeping--;
+                if (stop) break;
+            }
         }
+
+        //  [lo, hi) ֿΪһɲύȴȫ
+        void spawn_and_wait(void (*fn)(void*, int, int), void* ctx, int n_chunks) {
+            if (n_chunks <= 0) return;
+            atomic<int> pending{ 1 };
+            Task t;
+            t.run = fn;
+            t.ctx = ctx;
+            t.lo = 0;
+            t.hi = n_chunks;
+            t.pending = &pending;
+            execute(t);
+            wait(pending);
+        }
+
     public:
-        Parallel() : count(N_WORKERS), stop(false) {
-            for (int i = 0; i < count; i++)
+        // n_workers Ϊ 0 ʱ hardware_concurrency() ȷ߳
+        // ߳ڵȴʱҲ㣬ĬϱӲ߳ٴһ
+        explicit Parallel(int n_workers = 0) {
+            if (n_workers <= 0) {
+                n_workers = std::max(1, int(thread::hardware_concurrency()) - 1);
+            }
+            for (int i = 0; i < n_workers; i++) {
+                queues.push_back(make_unique<WorkQueue>());
+            }
+            for (int i = 0; i < n_workers; i++)
             {
                 std::cout << "" << i << "߳ " << std::endl;
-                work_threads.emplace_back(worker, this);
+                work_threads.emplace_back(&Parallel::run, this, i);
             }
         };
 
+        Parallel(const Parallel&) = delete;
+        Parallel(Parallel&&) = delete;
+
         ~Parallel() {
             {
-                std::unique_lock<std::mutex> lock(queue_mutex);
+                lock_guard lg(sleep_mutex);
                 stop = true;
             }
-            condition.notify_all();
+            sleep_cv.notify_all();
             for (auto& ww : work_threads) {
                 if (ww.joinable())ww.join();
             }
         }
 
+        int workers() const { return int(work_threads.size()); }
+
+        //  [begin, end)  grain Сֿ鲢ִ f(from, to)
+        // ֻֿ߽ȡ beginend  grain̵߳޹
+        template<typename F>
+        void parallel_for(int begin, int end, int grain, F&& f) {
+            if (end <= begin) return;
+            grain = std::max(1, grain);
+            int n_chunks = (end - begin + grain - 1) / grain;
+            if (n_chunks == 1) {
+                f(begin, end);
+                return;
+            }
+            struct Ctx {
+                F& f;
+                int begin, end, grain;
+            } ctx{ f, begin, end, grain };
+            spawn_and_wait([](void* p, int lo, int hi) {
+                Ctx& c = *(Ctx*)p;
+                for (int k = lo; k < hi; k++) {
+                    int from = c.begin + k * c.grain;
+                    c.f(from, std::min(c.end, from + c.grain));
+                }
+            }, &ctx, n_chunks);
+        }
+
+        // ֿ map(from, to)ֿٰ˳ combine Լ
+        // Լ˳̶˸ɸ
+        template<typename T, typename Map, typename Combine>
+        T parallel_reduce(int begin, int end, int grain, T identity, Map&& map, Combine&& combine) {
+            if (end <= begin) return identity;
+            grain = std::max(1, grain);
+            int n_chunks = (end - begin + grain - 1) / grain;
+            vector<T> partial(n_chunks, identity);
+            parallel_for(0, n_chunks, 1, [&](int lo, int hi) {
+                for (int k = lo; k < hi; k++) {
+                    int from = begin + k * grain;
+                    partial[k] = map(from, std::min(end, from + grain));
+                }
+            });
+            T result = identity;
+            for (auto& v : partial) {
+                result = combine(result, v);
+            }
+            return result;
+        }
+
+        // ִȫɺ󷵻
+        void invoke(const vector<function<void()>>& funcs) {
+            parallel_for(0, int(funcs.size()), 1, [&funcs](int from, int to) {
+                for (int i = from; i < to; i++) funcs[i]();
+            });
+        }
+
         void invoke(initializer_list<function<void()>> funcs) {
-            mutex mtx_finish;
-            unique_lock lock_finish(mtx_finish);
-            condition_variable cv_finish;
-
-            atomic<int> counter = 0;
-            auto on_finish = [&counter, &cv_finish]() {
-                counter++;
-                cv_finish.notify_one();
+            parallel_for(0, int(funcs.size()), 1, [&funcs](int from, int to) {
+                for (int i = from; i < to; i++) funcs.begin()[i]();
+            });
+        }
+
+        // ϵͼ
+        // add() ؽڵţdeps еĽڵȫɺýڵŻῪʼ
+        // ͼԷ run()ÿǰ
+        class TaskGraph {
+            struct Node {
+                function<void()> work;
+                vector<int> successors;
+                int n_deps = 0;
+                atomic<int> remaining{ 0 };
             };
+            vector<unique_ptr<Node>> nodes;
+            Parallel* pool = nullptr;
+            atomic<int>* pending = nullptr;
 
-            {
-                lock_guard lg(queue_mutex);
-                for (auto& f : funcs) {
-                    task_queue.push(Workload{ f, on_finish });
-                    condition.notify_one();
+            static void run_node(void* ctx, int lo, int hi);
+
+            void spawn(int i) {
+                (*pending)++;
+                Task t;
+                t.run = &TaskGraph::run_node;
+                t.ctx = this;
+                t.lo = i;
+                t.hi = i + 1;
+                t.pending = pending;
+                pool->push(t);
+            }
+
+        public:
+            int add(function<void()> work, const vector<int>& deps = {}) {
+                auto node = make_unique<Node>();
+                node->work = move(work);
+                node->n_deps = int(deps.size());
+                int id = int(nodes.size());
+                for (int d : deps) {
+                    if (d < 0 || d >= id) throw invalid_argument("TaskGraph: dependency must be added before its dependents");
+                    nodes[d]->successors.push_back(id);
                 }
+                nodes.push_back(move(node));
+                return id;
             }
 
-            cv_finish.wait(lock_finish, [&funcs, &counter]() { return funcs.size() == counter; });
+            int size() const { return int(nodes.size()); }
 
-        }
+            void clear() { nodes.clear(); }
+
+            void run(Parallel& p) {
+                if (nodes.empty()) return;
+                atomic<int> counter{ 0 };
+                pool = &p;
+                pending = &counter;
+                for (auto& n : nodes) {
+                    n->remaining = n->n_deps;
+                }
+                for (int i = 0; i < int(nodes.size()); i++) {
+                    if (nodes[i]->n_deps == 0) spawn(i);
+                }
+                p.wait(counter);
+                pool = nullptr;
+                pending = nullptr;
+            }
+        };
     };
 
+    inline void Parallel::TaskGraph::run_node(void* ctx, int lo, int) {
+        TaskGraph& g = *(TaskGraph*)ctx;
+        Node& node = *g.nodes[lo];
+        node.work();
+        for (int s : node.successors) {
+            if (--g.nodes[s]->remaining == 0) g.spawn(s);
+        }
+    }
+
 }
 
@@ -13,7 +13,7 @@ namespace Simflow {
         Timer(Timer&&) = delete;
         float ms() {
             Time cur = chrono::high_resolution_clock::now();
-            return chrono::duration_cast<chrono::milliseconds>(cur - _begin).count();
+            return chrono::duration<float, milli>(cur - _begin).count();
         }
     };
 }
\ No newline at end of file
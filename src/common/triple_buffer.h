@@ -0,0 +1,46 @@
+﻿#pragma once
+#include <memory>
+#include <mutex>
+
+namespace Simflow {
+    using namespace std;
+
+    // 三重缓冲：生产者写入 write_buffer() 后 publish()，消费者通过 read_buffer() 取得最近一次发布的数据
+    // 双方各自持有一个缓冲，互不等待；消费者读到的缓冲在下一次调用 read_buffer() 之前不会被改写
+    template<typename T>
+    class TripleBuffer {
+        unique_ptr<T> _buffers[3];
+        int _write = 0, _ready = 1, _read = 2;
+        bool _fresh = false;
+        mutex _mtx;
+    public:
+        template<typename... Args>
+        TripleBuffer(const Args&... args) {
+            for (auto& b : _buffers) {
+                b = make_unique<T>(args...);
+            }
+        }
+        TripleBuffer(const TripleBuffer&) = delete;
+        TripleBuffer(TripleBuffer&&) = delete;
+
+        // 仅由生产者调用
+        T* write_buffer() { return _buffers[_write].get(); }
+
+        void publish() {
+            lock_guard lg(_mtx);
+            swap(_write, _ready);
+            _fresh = true;
+        }
+
+        // 仅由消费者调用，updated 返回自上次读取后是否有新数据
+        T* read_buffer(bool* updated = nullptr) {
+            lock_guard lg(_mtx);
+            if (updated) *updated = _fresh;
+            if (_fresh) {
+                swap(_read, _ready);
+                _fresh = false;
+            }
+            return _buffers[_read].get();
+        }
+    };
+}
@@ -15,5 +15,7 @@ int main() {
 
 	gvm.event_frame_ready += win.on_frame_ready;
 
+	gvm.start_pipeline();
+
 	win.OnCreate();
 }
\ No newline at end of file
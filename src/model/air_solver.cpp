@@ -24,11 +24,33 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 #define SWAP(value0,value) {float *tmp=value0;value0=value;value=tmp;}
 
 AirSolver::AirSolver()
 {
+    totSize = 0;
+    pressureSolverType = PRESSURE_JACOBI;
+    pressureIterations = 20;
+    pressureTolerance = 0.0f;
+    pressureSolver = 0;
+    pool = 0;
+    pressureSolves = 0;
+    pressureIterationsRun = 0;
+    pressureResidual = 0.0f;
+    activeCells = 0;
+    tileSize = 0;
+    sleepSpeed = 0.0f;
+    tilesX = 0;
+    tilesY = 0;
+    regionX0 = regionX1 = regionY0 = regionY1 = 0;
+    regionSolver = 0;
+    regionSolverRow = 0;
+    regionSolverCol = 0;
+    regionSolidX = regionSolidY = -1;
 }
 
 AirSolver::~AirSolver()
@@ -42,7 +64,9 @@ AirSolver::~AirSolver()
     free(px);
     free(py);
     free(div);
-    free(p);
+    free(pWarm[0]);
+    free(pWarm[1]);
+    free(ptmp);
 
     //vorticity confinement
     free(vort);
@@ -52,6 +76,9 @@ AirSolver::~AirSolver()
     free(lenGrad);
     free(vcfx);
     free(vcfy);
+
+    delete pressureSolver;
+    delete regionSolver;
 }
 
 void AirSolver::init(int r, int c, float dt)
@@ -73,6 +100,7 @@ void AirSolver::init(int r, int c, float dt)
     diff = 0.0f;
     vorticity = 0.0f;
     timeStep = dt;
+    wallScale = 0.95f;
 
 
     vx = (float*)malloc(sizeof(float) * totSize);
@@ -84,7 +112,9 @@ void AirSolver::init(int r, int c, float dt)
     px = (float*)malloc(sizeof(float) * totSize);
     py = (float*)malloc(sizeof(float) * totSize);
     div = (float*)malloc(sizeof(float) * totSize);
-    p = (float*)malloc(sizeof(float) * totSize);
+    pWarm[0] = (float*)malloc(sizeof(float) * totSize);
+    pWarm[1] = (float*)malloc(sizeof(float) * totSize);
+    p = pWarm[0];
     ptmp = (float*)malloc(sizeof(float) * totSize);
 
     //vorticity confinement
@@ -104,6 +134,107 @@ void AirSolver::init(int r, int c, float dt)
             py[cIdx(i, j)] = (float)j + 0.5f;
         }
     }
+
+    memset(pWarm[0], 0, sizeof(float) * totSize);
+    memset(pWarm[1], 0, sizeof(float) * totSize);
+    setPressureSolver(pressureSolverType, pressureIterations, pressureTolerance);
+    setActiveTiles(tileSize, sleepSpeed);
+}
+
+void AirSolver::setPressureSolver(PressureSolverType type, int maxIterations, float tolerance)
+{
+    if (pressureSolver == 0 || type != pressureSolverType)
+    {
+        delete pressureSolver;
+        pressureSolver = PressureSolver::create(type);
+        pressureSolver->setParallel(pool);
+        delete regionSolver;
+        regionSolver = 0;
+    }
+    pressureSolverType = type;
+    pressureIterations = maxIterations;
+    pressureTolerance = tolerance;
+    if (totSize > 0)
+    {
+        pressureSolver->init(rowSize, colSize, wallScale);
+        if (!solid.empty()) pressureSolver->setSolid(solid.data());
+    }
+}
+
+void AirSolver::setParallel(Simflow::Parallel* parallel)
+{
+    pool = parallel;
+    if (pressureSolver != 0) pressureSolver->setParallel(pool);
+    if (regionSolver != 0) regionSolver->setParallel(pool);
+}
+
+void AirSolver::setActiveTiles(int tileSize, float sleepSpeed)
+{
+    this->tileSize = tileSize;
+    this->sleepSpeed = sleepSpeed;
+    if (totSize == 0) return;
+
+    //start from the whole grid, the first step lets the quiet tiles sleep
+    regionX0 = 1;
+    regionX1 = rowSize - 1;
+    regionY0 = 1;
+    regionY1 = colSize - 1;
+    if (tileSize > 0)
+    {
+        tilesX = (rowSize - 2 + tileSize - 1) / tileSize;
+        tilesY = (colSize - 2 + tileSize - 1) / tileSize;
+        tileAwake.assign(tilesX * tilesY, 1);
+    }
+}
+
+void AirSolver::wake(int index)
+{
+    if (tileSize <= 0) return;
+    int i = index % rowSize;
+    int j = index / rowSize;
+    if (i < 1) i = 1;
+    if (i > rowSize - 2) i = rowSize - 2;
+    if (j < 1) j = 1;
+    if (j > colSize - 2) j = colSize - 2;
+    tileAwake[(j - 1) / tileSize * tilesX + (i - 1) / tileSize] = 1;
+}
+
+void AirSolver::setSolid(const unsigned char* mask)
+{
+    solid.clear();
+    if (totSize == 0) return;
+    for (int j = 1; mask != 0 && j <= colSize - 2; j++)
+    {
+        for (int i = 1; i <= rowSize - 2; i++)
+        {
+            if (mask[cIdx(i, j)] == 0) continue;
+            if (solid.empty()) solid.assign(totSize, 0);
+            solid[cIdx(i, j)] = 1;
+        }
+    }
+    pressureSolver->setSolid(solid.empty() ? 0 : solid.data());
+    //the region solver takes its part of the mask on the next solve
+    regionSolverRow = 0;
+
+    float* fields[8] = { vx, vy, vx0, vy0, d, pWarm[0], pWarm[1], div };
+    for (int k = 0; k < 8; k++) clearSolid(fields[k], 1, rowSize - 1, 1, colSize - 1);
+}
+
+void AirSolver::clearSolid(float* value, int x0, int x1, int y0, int y1)
+{
+    if (solid.empty()) return;
+    gridForRowRange(pool, rowSize, y0, y1, [&](int j0, int j1)
+    {
+        for (int j = j0; j < j1; j++)
+        {
+            const unsigned char* s = solid.data() + cIdx(0, j);
+            float* row = value + cIdx(0, j);
+            for (int i = x0; i < x1; i++)
+            {
+                if (s[i]) row[i] = 0.0f;
+            }
+        }
+    });
 }
 
 void AirSolver::reset()
@@ -112,7 +243,18 @@ void AirSolver::reset()
     {
         vx[i] = 0.0f;
         vy[i] = 0.0f;
+        vx0[i] = 0.0f;
+        vy0[i] = 0.0f;
         d[i] = 0.0f;
+        pWarm[0][i] = 0.0f;
+        pWarm[1][i] = 0.0f;
+    }
+
+    //all at rest
+    if (tileSize > 0)
+    {
+        for (int t = 0; t < tilesX * tilesY; t++) tileAwake[t] = 0;
+        regionX0 = regionX1 = regionY0 = regionY1 = 0;
     }
 }
 
@@ -127,175 +269,298 @@ void AirSolver::cleanBuffer()
 
 void AirSolver::setBoundary(float* value, int flag)
 {
-    float m = 0.95;
-    //for velocity along x-axis
-    //if(flag == 1)
-
-    for (int i = 1; i <= rowSize - 2; i++)
-    {
-        value[cIdx(i, 0)] = value[cIdx(i, 1)] * m;
-        value[cIdx(i, colSize - 1)] = value[cIdx(i, colSize - 2)] * m;
-    }
-
-    for (int j = 1; j <= colSize - 2; j++)
-    {
-        value[cIdx(0, j)] = value[cIdx(1, j)] * m;
-        value[cIdx(rowSize - 1, j)] = value[cIdx(rowSize - 2, j)] * m;
-    }
-
-    //density
-
-    value[cIdx(0, 0)] = (value[cIdx(0, 1)] + value[cIdx(1, 0)]) / 2;
-    value[cIdx(rowSize - 1, 0)] = (value[cIdx(rowSize - 2, 0)] + value[cIdx(rowSize - 1, 1)]) / 2;
-    value[cIdx(0, colSize - 1)] = (value[cIdx(0, colSize - 2)] + value[cIdx(1, colSize - 1)]) / 2;
-    value[cIdx(rowSize - 1, colSize - 1)] = (value[cIdx(rowSize - 2, colSize - 1)] + value[cIdx(rowSize - 1, colSize - 2)]) / 2;
-
+    //same wall handling for velocity and density
+    gridBoundary(value, rowSize, colSize, wallScale);
 }
 
-void AirSolver::projection()
+void AirSolver::projection(int site)
 {
-    for (int i = 1; i <= rowSize - 2; i++)
+    double divSum = gridSumRowRange(pool, rowSize, regionY0, regionY1, [&](int j0, int j1)
     {
-        for (int j = 1; j <= colSize - 2; j++)
+        double bandSum = 0.0;
+        for (int j = j0; j < j1; j++)
         {
-            div[cIdx(i, j)] = 0.5f * (vx[cIdx(i + 1, j)] - vx[cIdx(i - 1, j)] + vy[cIdx(i, j + 1)] - vy[cIdx(i, j - 1)]);
-            p[cIdx(i, j)] = 0.0f;
+            const float* __restrict u = vx + cIdx(0, j);
+            const float* __restrict vB = vy + cIdx(0, j - 1);
+            const float* __restrict vT = vy + cIdx(0, j + 1);
+            float* __restrict dv = div + cIdx(0, j);
+            for (int i = regionX0; i < regionX1; i++)
+            {
+                dv[i] = 0.5f * (u[i + 1] - u[i - 1] + vT[i] - vB[i]);
+            }
+            if (!solid.empty())
+            {
+                const unsigned char* s = solid.data() + cIdx(0, j);
+                for (int i = regionX0; i < regionX1; i++)
+                {
+                    if (s[i]) dv[i] = 0.0f;
+                }
+            }
+            float rowSum = 0.0f;
+            for (int i = regionX0; i < regionX1; i++) rowSum += dv[i] * dv[i];
+            bandSum += rowSum;
         }
-    }
+        return bandSum;
+    });
     setBoundary(div, 0);
-    setBoundary(p, 0);
 
-    //projection iteration
-    for (int k = 0; k < 20; k++)
+    //warm start from this site's last pressure unless p = 0 (residual = RMS of div) is closer
+    p = pWarm[site];
+    setBoundary(p, 0);
+    float divRms = (float)sqrt(divSum / ((regionX1 - regionX0) * (regionY1 - regionY0)));
+    if (regionX0 == 1 && regionX1 == rowSize - 1 && regionY0 == 1 && regionY1 == colSize - 1)
     {
-        for (int i = 1; i <= rowSize - 2; i++)
-        {
-            for (int j = 1; j <= colSize - 2; j++)
-            {
-                p[cIdx(i, j)] = (p[cIdx(i + 1, j)] + p[cIdx(i - 1, j)] + p[cIdx(i, j + 1)] + p[cIdx(i, j - 1)] - div[cIdx(i, j)]) / 4.0f;
-            }
-        }
-        setBoundary(p, 0);
+        if (pressureSolver->residual(p, div) >= divRms) memset(p, 0, sizeof(float) * totSize);
+        pressureIterationsRun += pressureSolver->solve(p, div, pressureIterations, pressureTolerance);
+        if (pressureSolver->lastResidual > pressureResidual) pressureResidual = pressureSolver->lastResidual;
     }
+    else solveRegion(divRms);
+    pressureSolves++;
 
     //velocity minus grad of Pressure
-    for (int i = 1; i <= rowSize - 2; i++)
+    gridForRowRange(pool, rowSize, regionY0, regionY1, [&](int j0, int j1)
     {
-        for (int j = 1; j <= colSize - 2; j++)
+        for (int j = j0; j < j1; j++)
         {
-            vx[cIdx(i, j)] -= 0.5f * (p[cIdx(i + 1, j)] - p[cIdx(i - 1, j)]);
-            vy[cIdx(i, j)] -= 0.5f * (p[cIdx(i, j + 1)] - p[cIdx(i, j - 1)]);
+            const float* __restrict pr = p + cIdx(0, j);
+            const float* __restrict pB = p + cIdx(0, j - 1);
+            const float* __restrict pT = p + cIdx(0, j + 1);
+            float* __restrict u = vx + cIdx(0, j);
+            float* __restrict v = vy + cIdx(0, j);
+            if (solid.empty())
+            {
+                for (int i = regionX0; i < regionX1; i++)
+                {
+                    u[i] -= 0.5f * (pr[i + 1] - pr[i - 1]);
+                    v[i] -= 0.5f * (pT[i] - pB[i]);
+                }
+                continue;
+            }
+            //a solid neighbour mirrors the cell's pressure (no flux through the face), and what still flows
+            //into a solid neighbour is stopped
+            const unsigned char* s = solid.data() + cIdx(0, j);
+            const unsigned char* sB = s - rowSize;
+            const unsigned char* sT = s + rowSize;
+            for (int i = regionX0; i < regionX1; i++)
+            {
+                if (s[i])
+                {
+                    u[i] = 0.0f;
+                    v[i] = 0.0f;
+                    continue;
+                }
+                u[i] -= 0.5f * ((s[i + 1] ? pr[i] : pr[i + 1]) - (s[i - 1] ? pr[i] : pr[i - 1]));
+                v[i] -= 0.5f * ((sT[i] ? pr[i] : pT[i]) - (sB[i] ? pr[i] : pB[i]));
+                if ((s[i + 1] && u[i] > 0.0f) || (s[i - 1] && u[i] < 0.0f)) u[i] = 0.0f;
+                if ((sT[i] && v[i] > 0.0f) || (sB[i] && v[i] < 0.0f)) v[i] = 0.0f;
+            }
         }
-    }
+    });
     setBoundary(vx, 1);
     setBoundary(vy, 2);
 }
+void AirSolver::solveRegion(float divRms)
+{
+    //the region and its ring as a grid of its own: a side on a wall keeps wallScale, an open side has p = 0 beyond it,
+    //which is what the ring cells copied from the resting air hold
+    int r = regionX1 - regionX0 + 2;
+    int c = regionY1 - regionY0 + 2;
+    float walls[4];
+    walls[SIDE_LEFT] = regionX0 == 1 ? wallScale : 0.0f;
+    walls[SIDE_RIGHT] = regionX1 == rowSize - 1 ? wallScale : 0.0f;
+    walls[SIDE_BOTTOM] = regionY0 == 1 ? wallScale : 0.0f;
+    walls[SIDE_TOP] = regionY1 == colSize - 1 ? wallScale : 0.0f;
+    if (regionSolver == 0)
+    {
+        regionSolver = PressureSolver::create(pressureSolverType);
+        regionSolver->setParallel(pool);
+        regionSolverRow = 0;
+    }
+    if (r != regionSolverRow || c != regionSolverCol || memcmp(walls, regionWalls, sizeof(walls)) != 0)
+    {
+        regionSolver->init(r, c, walls);
+        regionSolverRow = r;
+        regionSolverCol = c;
+        memcpy(regionWalls, walls, sizeof(walls));
+        regionP.assign(r * c, 0.0f);
+        regionDiv.assign(r * c, 0.0f);
+        regionSolidX = regionSolidY = -1;
+    }
+    //the region's part of the solid mask, again whenever the region moves
+    if (!solid.empty() && (regionX0 != regionSolidX || regionY0 != regionSolidY))
+    {
+        regionSolid.resize(r * c);
+        for (int j = 0; j < c; j++) memcpy(regionSolid.data() + j * r, solid.data() + cIdx(regionX0 - 1, regionY0 - 1 + j), r);
+        regionSolver->setSolid(regionSolid.data());
+        regionSolidX = regionX0;
+        regionSolidY = regionY0;
+    }
 
+    float* rp = regionP.data();
+    float* rd = regionDiv.data();
+    for (int j = 0; j < c; j++)
+    {
+        memcpy(rp + j * r, p + cIdx(regionX0 - 1, regionY0 - 1 + j), sizeof(float) * r);
+        memcpy(rd + j * r, div + cIdx(regionX0 - 1, regionY0 - 1 + j), sizeof(float) * r);
+    }
+    if (regionSolver->residual(rp, rd) >= divRms) memset(rp, 0, sizeof(float) * r * c);
+    pressureIterationsRun += regionSolver->solve(rp, rd, pressureIterations, pressureTolerance);
+    if (regionSolver->lastResidual > pressureResidual) pressureResidual = regionSolver->lastResidual;
+    for (int j = 1; j <= c - 2; j++)
+    {
+        memcpy(p + cIdx(regionX0, regionY0 - 1 + j), rp + j * r + 1, sizeof(float) * (r - 2));
+    }
+    setBoundary(p, 0);
+}
 void AirSolver::advection(float* value, float* value0, float* u, float* v, int flag)
 {
-    float oldX;
-    float oldY;
-    int i0;
-    int i1;
-    int j0;
-    int j1;
-    float wL;
-    float wR;
-    float wB;
-    float wT;
-
-    for (int i = 1; i <= rowSize - 2; i++)
+    advection(value, value0, u, v, flag, 1, rowSize - 1, 1, colSize - 1);
+}
+void AirSolver::advection(float* value, float* value0, float* u, float* v, int flag, int x0, int x1, int y0, int y1)
+{
+    // cell centres are px = i + 0.5, py = j + 0.5, computed inline instead of loaded
+    gridForRowRange(pool, rowSize, y0, y1, [&](int j0, int j1)
     {
-        for (int j = 1; j <= colSize - 2; j++)
+        for (int j = j0; j < j1; j++)
         {
-            oldX = px[cIdx(i, j)] - u[cIdx(i, j)] * timeStep;
-            oldY = py[cIdx(i, j)] - v[cIdx(i, j)] * timeStep;
-
-            if (oldX < minX) oldX = minX;
-            if (oldX > maxX) oldX = maxX;
-            if (oldY < minY) oldY = minY;
-            if (oldY > maxY) oldY = maxY;
-
-            i0 = (int)(oldX - 0.5f);
-            j0 = (int)(oldY - 0.5f);
-            i1 = i0 + 1;
-            j1 = j0 + 1;
-
-            wL = px[cIdx(i1, j0)] - oldX;
-            wR = 1.0f - wL;
-            wB = py[cIdx(i0, j1)] - oldY;
-            wT = 1.0f - wB;
-
-            value[cIdx(i, j)] = wB * (wL * value0[cIdx(i0, j0)] + wR * value0[cIdx(i1, j0)]) +
-                wT * (wL * value0[cIdx(i0, j1)] + wR * value0[cIdx(i1, j1)]);
+            const float* __restrict uRow = u + cIdx(0, j);
+            const float* __restrict vRow = v + cIdx(0, j);
+            float* __restrict out = value + cIdx(0, j);
+            int i = x0;
+#if defined(__AVX2__)
+            const __m256 vStep = _mm256_set1_ps(timeStep);
+            const __m256 vMinX = _mm256_set1_ps(minX), vMaxX = _mm256_set1_ps(maxX);
+            const __m256 vMinY = _mm256_set1_ps(minY), vMaxY = _mm256_set1_ps(maxY);
+            const __m256 half = _mm256_set1_ps(0.5f), one = _mm256_set1_ps(1.0f);
+            const __m256 lane = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+            const __m256i vRowSize = _mm256_set1_epi32(rowSize);
+            const float cy = (float)j + 0.5f;
+            for (; i + 8 <= x1; i += 8)
+            {
+                __m256 oldX = _mm256_sub_ps(_mm256_add_ps(_mm256_set1_ps((float)i), lane), _mm256_mul_ps(_mm256_loadu_ps(uRow + i), vStep));
+                __m256 oldY = _mm256_sub_ps(_mm256_set1_ps(cy), _mm256_mul_ps(_mm256_loadu_ps(vRow + i), vStep));
+                oldX = _mm256_min_ps(_mm256_max_ps(oldX, vMinX), vMaxX);
+                oldY = _mm256_min_ps(_mm256_max_ps(oldY, vMinY), vMaxY);
+
+                __m256i i0 = _mm256_cvttps_epi32(_mm256_sub_ps(oldX, half));
+                __m256i j0 = _mm256_cvttps_epi32(_mm256_sub_ps(oldY, half));
+                __m256 wL = _mm256_sub_ps(_mm256_add_ps(_mm256_cvtepi32_ps(i0), _mm256_set1_ps(1.5f)), oldX);
+                __m256 wR = _mm256_sub_ps(one, wL);
+                __m256 wB = _mm256_sub_ps(_mm256_add_ps(_mm256_cvtepi32_ps(j0), _mm256_set1_ps(1.5f)), oldY);
+                __m256 wT = _mm256_sub_ps(one, wB);
+
+                __m256i idx = _mm256_add_epi32(_mm256_mullo_epi32(j0, vRowSize), i0);
+                __m256 v00 = _mm256_i32gather_ps(value0, idx, 4);
+                __m256 v10 = _mm256_i32gather_ps(value0 + 1, idx, 4);
+                __m256 v01 = _mm256_i32gather_ps(value0 + rowSize, idx, 4);
+                __m256 v11 = _mm256_i32gather_ps(value0 + rowSize + 1, idx, 4);
+
+                __m256 bottom = _mm256_add_ps(_mm256_mul_ps(wL, v00), _mm256_mul_ps(wR, v10));
+                __m256 top = _mm256_add_ps(_mm256_mul_ps(wL, v01), _mm256_mul_ps(wR, v11));
+                _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_mul_ps(wB, bottom), _mm256_mul_ps(wT, top)));
+            }
+#endif
+            for (; i < x1; i++)
+            {
+                float oldX = (float)i + 0.5f - uRow[i] * timeStep;
+                float oldY = (float)j + 0.5f - vRow[i] * timeStep;
+
+                if (oldX < minX) oldX = minX;
+                if (oldX > maxX) oldX = maxX;
+                if (oldY < minY) oldY = minY;
+                if (oldY > maxY) oldY = maxY;
+
+                int i0 = (int)(oldX - 0.5f);
+                int j0 = (int)(oldY - 0.5f);
+
+                float wL = (float)i0 + 1.5f - oldX;
+                float wR = 1.0f - wL;
+                float wB = (float)j0 + 1.5f - oldY;
+                float wT = 1.0f - wB;
+
+                const float* s = value0 + cIdx(i0, j0);
+                out[i] = wB * (wL * s[0] + wR * s[1]) + wT * (wL * s[rowSize] + wR * s[rowSize + 1]);
+            }
         }
-    }
+    });
+    clearSolid(value, x0, x1, y0, y1);
 
     setBoundary(value, flag);
 }
 
-void AirSolver::diffusion(float* value, float* value0, float rate, int flag)
+void AirSolver::diffusion(float* value, float* value0, float rate, int)
 {
     for (int i = 0; i < totSize; i++) value[i] = 0.0f;
     float a = rate * timeStep;
 
-    for (int k = 0; k < 2; k++)
-    {
-        for (int i = 1; i <= rowSize - 2; i++)
-        {
-            for (int j = 1; j <= colSize - 2; j++)
-            {
-                value[cIdx(i, j)] = (value0[cIdx(i, j)] + a * (value[cIdx(i + 1, j)] + value[cIdx(i - 1, j)] + value[cIdx(i, j + 1)] + value[cIdx(i, j - 1)])) / (4.0f * a + 1.0f);
-            }
-        }
-        setBoundary(value, flag);
-    }
+    //two Jacobi sweeps, value and ptmp ping-pong; setBoundary is gridBoundary with wallScale for every flag
+    const float walls[4] = { wallScale, wallScale, wallScale, wallScale };
+    gridJacobiSweeps(value, ptmp, value0, 1.0f, a, 1.0f / (4.0f * a + 1.0f), walls, rowSize, colSize, 2, blockScratch, pool);
 }
 
 void AirSolver::vortConfinement()
 {
-    for (int i = 1; i <= rowSize - 2; i++)
+    gridForRows(pool, rowSize, colSize, [&](int j0, int j1)
     {
-        for (int j = 1; j <= colSize - 2; j++)
+        for (int j = j0; j < j1; j++)
         {
-            vort[cIdx(i, j)] = 0.5f * (vy[cIdx(i + 1, j)] - vy[cIdx(i - 1, j)] - vx[cIdx(i, j + 1)] + vx[cIdx(i, j - 1)]);
-            if (vort[cIdx(i, j)] >= 0.0f) absVort[cIdx(i, j)] = vort[cIdx(i, j)];
-            else absVort[cIdx(i, j)] = -vort[cIdx(i, j)];
+            const float* __restrict uB = vx + cIdx(0, j - 1);
+            const float* __restrict uT = vx + cIdx(0, j + 1);
+            const float* __restrict v = vy + cIdx(0, j);
+            float* __restrict w = vort + cIdx(0, j);
+            float* __restrict aw = absVort + cIdx(0, j);
+            for (int i = 1; i <= rowSize - 2; i++)
+            {
+                w[i] = 0.5f * (v[i + 1] - v[i - 1] - uT[i] + uB[i]);
+                aw[i] = fabsf(w[i]);
+            }
         }
-    }
+    });
     setBoundary(vort, 0);
     setBoundary(absVort, 0);
 
-    for (int i = 1; i <= rowSize - 2; i++)
+    gridForRows(pool, rowSize, colSize, [&](int j0, int j1)
     {
-        for (int j = 1; j <= colSize - 2; j++)
+        for (int j = j0; j < j1; j++)
         {
-            gradVortX[cIdx(i, j)] = 0.5f * (absVort[cIdx(i + 1, j)] - absVort[cIdx(i - 1, j)]);
-            gradVortY[cIdx(i, j)] = 0.5f * (absVort[cIdx(i, j + 1)] - absVort[cIdx(i, j - 1)]);
-            lenGrad[cIdx(i, j)] = sqrt(gradVortX[cIdx(i, j)] * gradVortX[cIdx(i, j)] + gradVortY[cIdx(i, j)] * gradVortY[cIdx(i, j)]);
-            if (lenGrad[cIdx(i, j)] < 0.01f)
-            {
-                vcfx[cIdx(i, j)] = 0.0f;
-                vcfy[cIdx(i, j)] = 0.0f;
-            }
-            else
+            const float* __restrict aw = absVort + cIdx(0, j);
+            const float* __restrict awB = absVort + cIdx(0, j - 1);
+            const float* __restrict awT = absVort + cIdx(0, j + 1);
+            float* __restrict gx = gradVortX + cIdx(0, j);
+            float* __restrict gy = gradVortY + cIdx(0, j);
+            float* __restrict len = lenGrad + cIdx(0, j);
+            float* __restrict fx = vcfx + cIdx(0, j);
+            float* __restrict fy = vcfy + cIdx(0, j);
+            for (int i = 1; i <= rowSize - 2; i++)
             {
-                vcfx[cIdx(i, j)] = gradVortX[cIdx(i, j)] / lenGrad[cIdx(i, j)];
-                vcfy[cIdx(i, j)] = gradVortY[cIdx(i, j)] / lenGrad[cIdx(i, j)];
+                gx[i] = 0.5f * (aw[i + 1] - aw[i - 1]);
+                gy[i] = 0.5f * (awT[i] - awB[i]);
+                len[i] = sqrtf(gx[i] * gx[i] + gy[i] * gy[i]);
+                float inv = len[i] < 0.01f ? 0.0f : 1.0f / len[i];
+                fx[i] = gx[i] * inv;
+                fy[i] = gy[i] * inv;
             }
         }
-    }
+    });
     setBoundary(vcfx, 0);
     setBoundary(vcfy, 0);
 
-    for (int i = 1; i <= rowSize - 2; i++)
+    gridForRows(pool, rowSize, colSize, [&](int j0, int j1)
     {
-        for (int j = 1; j <= colSize - 2; j++)
+        for (int j = j0; j < j1; j++)
         {
-            vx[cIdx(i, j)] += vorticity * (vcfy[cIdx(i, j)] * vort[cIdx(i, j)]);
-            vy[cIdx(i, j)] += vorticity * (-vcfx[cIdx(i, j)] * vort[cIdx(i, j)]);
+            const float* __restrict w = vort + cIdx(0, j);
+            const float* __restrict fx = vcfx + cIdx(0, j);
+            const float* __restrict fy = vcfy + cIdx(0, j);
+            float* __restrict u = vx + cIdx(0, j);
+            float* __restrict v = vy + cIdx(0, j);
+            for (int i = 1; i <= rowSize - 2; i++)
+            {
+                u[i] += vorticity * (fy[i] * w[i]);
+                v[i] += vorticity * (-fx[i] * w[i]);
+            }
         }
-    }
+    });
 
     setBoundary(vx, 1);
     setBoundary(vy, 2);
@@ -303,17 +568,19 @@ void AirSolver::vortConfinement()
 
 void AirSolver::addSource()
 {
-    int index;
-    for (int i = 1; i <= rowSize - 2; i++)
+    gridForRows(pool, rowSize, colSize, [&](int j0, int j1)
     {
-        for (int j = 1; j <= colSize - 2; j++)
+        for (int j = j0; j < j1; j++)
         {
-            index = cIdx(i, j);
-            vx[index] += vx0[index];
-            vy[index] += vy0[index];
-            d[index] += d0[index];
+            int index = cIdx(0, j);
+            for (int i = 1; i <= rowSize - 2; i++)
+            {
+                vx[index + i] += vx0[index + i];
+                vy[index + i] += vy0[index + i];
+                d[index + i] += d0[index + i];
+            }
         }
-    }
+    });
 
     //setBoundary(vx, 1);
     //setBoundary(vy, 2);
@@ -330,16 +597,115 @@ void AirSolver::animVel()
     //    diffusion(vy, vy0, diff, 2);
     //}
 
+    pressureSolves = 0;
+    pressureIterationsRun = 0;
+    pressureResidual = 0.0f;
 
-    projection();
+    if (tileSize > 0) updateRegion();
+    activeCells = (regionX1 - regionX0) * (regionY1 - regionY0);
+    if (activeCells == 0) return;
 
+    projection(0);
+
+    //outside the region vx0 and vx are both 0, so advecting only the region leaves the swapped buffers consistent
     SWAP(vx0, vx);
     SWAP(vy0, vy);
-    advection(vx, vx0, vx0, vy0, 1);
-    advection(vy, vy0, vx0, vy0, 2);
+    advection(vx, vx0, vx0, vy0, 1, regionX0, regionX1, regionY0, regionY1);
+    advection(vy, vy0, vx0, vy0, 2, regionX0, regionX1, regionY0, regionY1);
+
+    projection(1);
+
+    if (tileSize > 0) sleepTiles();
+}
+void AirSolver::updateRegion()
+{
+    int tx0 = tilesX, tx1 = -1, ty0 = tilesY, ty1 = -1;
+    for (int ty = 0; ty < tilesY; ty++)
+    {
+        for (int tx = 0; tx < tilesX; tx++)
+        {
+            if (!tileAwake[ty * tilesX + tx]) continue;
+            if (tx < tx0) tx0 = tx;
+            if (tx > tx1) tx1 = tx;
+            if (ty < ty0) ty0 = ty;
+            if (ty > ty1) ty1 = ty;
+        }
+    }
+
+    int x0 = 0, x1 = 0, y0 = 0, y1 = 0;
+    if (tx1 >= 0)
+    {
+        //the box of the awake tiles dilated by one tile, in cells
+        tx0 = tx0 > 0 ? tx0 - 1 : 0;
+        ty0 = ty0 > 0 ? ty0 - 1 : 0;
+        tx1 = tx1 < tilesX - 1 ? tx1 + 1 : tilesX - 1;
+        ty1 = ty1 < tilesY - 1 ? ty1 + 1 : tilesY - 1;
+        x0 = 1 + tx0 * tileSize;
+        y0 = 1 + ty0 * tileSize;
+        x1 = 1 + (tx1 + 1) * tileSize < rowSize - 1 ? 1 + (tx1 + 1) * tileSize : rowSize - 1;
+        y1 = 1 + (ty1 + 1) * tileSize < colSize - 1 ? 1 + (ty1 + 1) * tileSize : colSize - 1;
+    }
 
-    projection();
+    //the cells leaving the region come to rest; their tiles were all asleep, so they hold less than sleepSpeed
+    float* rest[6] = { vx, vy, vx0, vy0, pWarm[0], pWarm[1] };
+    bool cleared = false;
+    for (int j = regionY0; j < regionY1; j++)
+    {
+        int keep0 = x0, keep1 = x1;
+        if (j < y0 || j >= y1 || keep1 <= keep0) keep0 = keep1 = regionX1;
+        if (keep0 <= regionX0 && keep1 >= regionX1) continue;
+        for (int k = 0; k < 6; k++)
+        {
+            float* row = rest[k] + cIdx(0, j);
+            if (regionX0 < keep0) memset(row + regionX0, 0, sizeof(float) * ((keep0 < regionX1 ? keep0 : regionX1) - regionX0));
+            if (keep1 < regionX1)
+            {
+                int from = keep1 > regionX0 ? keep1 : regionX0;
+                memset(row + from, 0, sizeof(float) * (regionX1 - from));
+            }
+        }
+        cleared = true;
+    }
+    if (cleared)
+    {
+        for (int k = 0; k < 6; k++) setBoundary(rest[k], 0);
+    }
 
+    regionX0 = x0;
+    regionX1 = x1;
+    regionY0 = y0;
+    regionY1 = y1;
+}
+void AirSolver::sleepTiles()
+{
+    //a tile stays awake while its air moves faster than sleepSpeed or its divergence before the last projection
+    //exceeds it; the tiles outside the region are all asleep
+    for (int t = 0; t < tilesX * tilesY; t++) tileAwake[t] = 0;
+    int ty0 = (regionY0 - 1) / tileSize;
+    int ty1 = (regionY1 - 2) / tileSize + 1;
+    auto sleepRows = [&](int from, int to)
+    {
+        for (int ty = from; ty < to; ty++)
+        {
+            int j0 = 1 + ty * tileSize;
+            int j1 = j0 + tileSize < colSize - 1 ? j0 + tileSize : colSize - 1;
+            for (int j = j0; j < j1; j++)
+            {
+                const float* u = vx + cIdx(0, j);
+                const float* v = vy + cIdx(0, j);
+                const float* dv = div + cIdx(0, j);
+                for (int i = regionX0; i < regionX1; i++)
+                {
+                    if (fabsf(u[i]) > sleepSpeed || fabsf(v[i]) > sleepSpeed || fabsf(dv[i]) > sleepSpeed)
+                    {
+                        tileAwake[ty * tilesX + (i - 1) / tileSize] = 1;
+                    }
+                }
+            }
+        }
+    };
+    if (pool != 0) pool->parallel_for(ty0, ty1, 1, sleepRows);
+    else sleepRows(ty0, ty1);
 }
 
 void AirSolver::animDen()
@@ -22,6 +22,8 @@
 #ifndef __GRIDSTABLESOLVER_H__
 #define __GRIDSTABLESOLVER_H__
 
+#include "pressure_solver.h"
+
 class AirSolver
 {
 public:
@@ -36,7 +38,7 @@ public:
 
     //animation
     void setBoundary(float *value, int flag);
-    void projection();
+    void projection(int site = 0);
     void advection(float *value, float *value0, float *u, float *v, int flag);
     void diffusion(float *value, float *value0, float rate, int flag);
     void vortConfinement();
@@ -44,6 +46,27 @@ public:
     void animVel();
     void animDen();
 
+    //pressure solve used by projection: at most maxIterations of the solver's own steps, fewer once the
+    //divergence left per cell (RMS) is below tolerance; each projection starts from the pressure the same
+    //call site found last frame, or from 0 when that leaves less divergence
+    void setPressureSolver(PressureSolverType type, int maxIterations, float tolerance = 0.0f);
+
+    //stencil passes run in bands of rows on this pool, serially when it is 0; results do not depend on it
+    void setParallel(Simflow::Parallel *parallel);
+
+    //active region: with tileSize > 0, animVel only works on the box around the tiles (tileSize x tileSize cells)
+    //where the air moved faster than sleepSpeed or the divergence exceeded it in the last step, or that wake()
+    //touched since, dilated by one tile; the air outside is held at rest (velocity and pressure 0) and skipped,
+    //and a box short of a wall solves the pressure with p = 0 beyond it. tileSize 0 runs every cell every step
+    void setActiveTiles(int tileSize, float sleepSpeed);
+    //velocity was written into cell index (e.g. through getVX), wake its tile for the next animVel
+    void wake(int index);
+
+    //solid cells: solid[idx] != 0 (ring entries ignored), 0 clears the mask. Solid cells hold no air (velocity,
+    //density and pressure stay 0 there), the pressure solve closes their faces and projection stops the air
+    //flowing into them; air sealed off from the walls by solid cells is left out of the pressure solve
+    void setSolid(const unsigned char *solid);
+
     //getter
     int getRowSize(){ return rowSize; }
     int getColSize(){ return colSize; }
@@ -65,6 +88,11 @@ public:
 
 private:
     int cIdx(int x, int y){ return y*rowSize+x; }
+    void advection(float *value, float *value0, float *u, float *v, int flag, int x0, int x1, int y0, int y1);
+    void updateRegion();
+    void sleepTiles();
+    void solveRegion(float divRms);
+    void clearSolid(float *value, int x0, int x1, int y0, int y1);
 
 public:
     int rowSize;
@@ -84,6 +112,36 @@ public:
     float diff;
     float vorticity;
     float timeStep;
+    float wallScale;
+    PressureSolverType pressureSolverType;
+    int pressureIterations;
+    float pressureTolerance;
+    PressureSolver *pressureSolver;
+    Simflow::Parallel *pool;
+
+    //pressure and region statistics of the last animVel call
+    int pressureSolves;
+    int pressureIterationsRun;
+    float pressureResidual; //largest divergence left by a solve
+    int activeCells; //cells in the region worked on
+
+    //active region, see setActiveTiles
+    int tileSize;
+    float sleepSpeed;
+    int tilesX;
+    int tilesY;
+    std::vector<char> tileAwake;
+    int regionX0, regionX1, regionY0, regionY1; //interior cells [regionX0, regionX1) x [regionY0, regionY1), empty at rest
+    PressureSolver *regionSolver; //pressure solve on a region smaller than the grid
+    int regionSolverRow;
+    int regionSolverCol;
+    float regionWalls[4];
+    std::vector<unsigned char> regionSolid; //the solid mask under the region solver
+    int regionSolidX, regionSolidY; //region origin regionSolid was taken at
+    std::vector<float> regionP;
+    std::vector<float> regionDiv;
+
+    std::vector<unsigned char> solid; //solid cell mask with a fluid ring, empty without solid cells
 
     float *vx;
     float *vy;
@@ -95,6 +153,8 @@ public:
     float *py;
     float *div;
     float *p, *ptmp;
+    std::vector<float> blockScratch; //tiles of the temporally blocked diffusion sweeps
+    float *pWarm[2]; //last pressure of each projection call in animVel, p points to the latest
     //vorticity confinement
     float *vort;
     float *absVort;
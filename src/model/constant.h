@@ -8,16 +8,46 @@ namespace Simflow {
 
     constexpr float K_AIR_RESISTANCE = 0.2;
     constexpr int K_AIRFLOW_DOWNSAMPLE = 4;
+    const int K_AIR_PRESSURE_CYCLES = 4; // max multigrid V-cycles per pressure solve of the air grid
+    const float K_AIR_PRESSURE_TOLERANCE = 1E-3f; // pressure solves stop once the RMS divergence left per air cell is below this
+    const int K_AIR_TILE = 16; // tile size (air cells) of the active region of the air solver
+    const float K_AIR_SLEEP_VELOCITY = 0.05f; // air tiles slower than this, and with less divergence, sleep
+    const int K_AIR_PRESSURE_MIN_CYCLES = 1; // fewest V-cycles the quality governor may leave to a pressure solve
+    const int K_AIR_PERIOD = 2; // frames per air step; the air solver advances K_AIR_PERIOD * K_DT, other frames hold the air field
 
-    const int K_LIQUID_GRID_DOWNSAMPLE = 4;
-    const int K_LIQUID_ITERATIONS = 5;
+    const int K_LIQUID_ITERATIONS = 8; // max liquid substeps per frame
+    const int K_LIQUID_MIN_ITERATIONS = 2; // lowest max substeps the quality governor may leave
+    const float K_LIQUID_CFL = 0.045f; // a water particle moves at most this share of K_LIQUID_RADIUS per liquid substep
+    const float K_LIQUID_CFL_PERCENTILE = 0.9f; // the substep count follows this percentile of the awake water's speeds and accelerations
+    const int K_LIQUID_SUBSTEP_HOLD = 10; // frames the liquid substep count must be allowed to drop before it drops by one
+    const float K_LIQUID_MAX_ACC = 100.f; // the SPH acceleration of a water particle is clamped to this
     const float K_LIQUID_RADIUS = 2.f;//16.f * K_LIQUID_SCALE; // kernel radius
+    const int K_LIQUID_TILE_ROWS = 16; // rows per tile when the liquid substeps run in parallel
+    const int K_LIQUID_SKIN = 1; // extra pixel radius of the cached neighbor lists; rebuilt once a particle's pixel moves farther than this
 
-    const float K_COLLISION_STEP_LENGTH = .5;
     const float K_COLLISION_RESTITUTION = 0.0;
+    const int K_POSITION_GRAIN = 1024; // particles per chunk in the parallel position update
+
+    const int K_SLEEP_FRAMES = 30; // frames at rest before a particle sleeps
+    const float K_SLEEP_MOVEMENT = 0.01f; // max movement per frame counted as rest
+    const float K_SLEEP_VELOCITY = 4.f; // max velocity counted as rest
+    const int K_WAKE_RADIUS = 2; // pixels around a moving particle whose sleepers are woken
+    const float K_WAKE_AIR_VELOCITY = 5.f; // air speed that wakes a sleeping particle
 
     const float K_HEAT_DELTA = 5.0f;
     const int K_HEAT_ITERATIONS = 20;
+    const float K_HEAT_TOLERANCE = 1E-4f; // heat iterations stop once no temperature changes by more than this
+    const int K_HEAT_PERIOD = 4; // frames per heat step; it advances K_HEAT_PERIOD * K_DT, other frames hold the temperatures
+    const float K_HEAT_MAX_RATE = 0.9f; // max share of the way to the neighbors' mean a heat iteration may move; longer steps iterate more
+    const int K_HEAT_MAX_SLOWDOWN = 4; // the quality governor may slow heat transfer down to 1 / this of its real speed
+    const int K_HEAT_TILE = 8; // tile size (pixels) of the active set in the grid heat solver
+
+    const int K_SORT_GRAIN = 8192; // particles per chunk in the parallel reorder
+    const float K_RESORT_FULL_RATIO = 0.05f; // above this fraction of moved particles, re-sort everything
+
+    const float K_GOVERNOR_SMOOTHING = 0.2f; // weight of the latest frame in the governor's smoothed frame and stage times
+    const int K_GOVERNOR_HOLD_FRAMES = 15; // frames the quality governor waits after a change before the next one
+    const float K_GOVERNOR_RECOVER = 0.75f; // quality is restored while the smoothed frame time is below this share of the budget
 
     const float EPS = 1E-6;
 }
\ No newline at end of file
@@ -4,12 +4,16 @@
 #include "../common/array2d.h"
 #include "../common/timer.h"
 #include "air_solver.h"
+#include "occupancy_map.h"
+#include "sph_kernel.h"
 #include "constant.h"
 #include <algorithm>
 #include "utility.h"
 #include <vector>
 #include <queue>
 #include <chrono>
+#include <cstdint>
+#include <cstring>
 #include "../common/parallel.h"
 
 namespace Simflow {
@@ -43,33 +47,29 @@ namespace Simflow {
             }
         };
 
-        struct BlockLiquidList {
-            vector<int> idx_lp;
-            BlockLiquidList() : idx_lp(16) {}
-        };
-
 
         struct StateCur {
             int particles = 0;
             vector<PixelParticleList> map_index; // 画布某个位置的粒子下标 map_index[idx(r,c)]
-            vector<BlockLiquidList> map_block_liquid;
             vector<ParticleType> p_type;
             vector<float> p_heat;
             vector<vec2> p_pos, p_vel, p_movement;
-            StateCur(int n_map) : map_index(n_map), map_block_liquid(n_map / K_LIQUID_GRID_DOWNSAMPLE / K_LIQUID_GRID_DOWNSAMPLE) {}
-            void reset(int n) {
+            vector<int> p_sleep; // 连续静止的帧数，达到 K_SLEEP_FRAMES 即为休眠
+            StateCur(int n_map) : map_index(n_map) {}
+            void resize(int n) {
                 particles = n;
                 p_type.resize(n);
                 p_pos.resize(n);
                 p_vel.resize(n);
                 p_movement.resize(n);
                 p_heat.resize(n);
+                p_sleep.resize(n);
+            }
+            void reset(int n) {
+                resize(n);
                 for (auto& lst : map_index) {
                     lst = PixelParticleList();
                 }
-                for (auto& lst : map_block_liquid) {
-                    lst.idx_lp.clear();
-                }
             }
         } state_cur;
 
@@ -78,6 +78,7 @@ namespace Simflow {
             vector<ParticleType> p_type;
             vector<float> p_heat;
             vector<vec2> p_pos, p_vel, p_movement;
+            vector<int> p_sleep;
             void reset(int n) {
                 particles = n;
                 p_type.resize(n);
@@ -85,9 +86,37 @@ namespace Simflow {
                 p_vel.resize(n);
                 p_movement.resize(n);
                 p_heat.resize(n);
+                p_sleep.resize(n);
             }
         } state_next;
 
+        // 静态固体（铁）不进入粒子数组，用占用位图和逐像素温度表示
+        // 固体只能添加，位置不变，因此各阶段只读 bits，温度由 compute_heat 更新
+        struct SolidLayer {
+            vector<uint64_t> bits; // 每像素一位
+            vector<float> heat; // 逐像素温度，仅固体像素有效
+            vector<int> cells; // 全部固体像素的画布下标，按添加顺序
+            vector<int> air_count; // 每个气流网格内（远离边界的）固体像素数
+            vector<int> air_cells; // air_count 非零的气流网格
+            vector<unsigned char> air_solid; // 被固体填满的气流网格，作为 AirSolver 的固体掩码
+            bool air_solid_changed = false; // air_solid 有新增网格，尚未交给 AirSolver
+            SolidLayer(int n_map, int n_air) : bits((n_map + 63) / 64), heat(n_map), air_count(n_air), air_solid(n_air) {}
+            bool test(int im) const { return (bits[im >> 6] >> (im & 63)) & 1; }
+            // [from, to] 内是否有固体像素，按字检查
+            bool any_in(int from, int to) const {
+                for (int w = from >> 6; w <= to >> 6; w++) {
+                    uint64_t word = bits[w];
+                    if (w == from >> 6) word &= ~uint64_t(0) << (from & 63);
+                    if (w == to >> 6 && (to & 63) != 63) word &= (uint64_t(1) << ((to & 63) + 1)) - 1;
+                    if (word) return true;
+                }
+                return false;
+            }
+        } solid;
+
+        // 被粒子或固体占用的像素，供碰撞检测的射线遍历使用，complete() 中随画布索引一起重建
+        OccupancyMap occupancy;
+
         //int width, height;
         //int width_air, height_air;
         //int width_liquid, height_liquid;
@@ -100,10 +129,25 @@ namespace Simflow {
         }
         int idx(int c, int r) { return r * width + c; }
         int idx(ivec2 v) { return idx(v.x, v.y); }
-        int idx_liquid(int c, int r) { return r / K_LIQUID_GRID_DOWNSAMPLE * (width / K_LIQUID_GRID_DOWNSAMPLE) + c / K_LIQUID_GRID_DOWNSAMPLE; }
-        int idx_liquid(ivec2 v) { return idx_liquid(v.x, v.y); }
         int idx_air(int c, int r) { return r / K_AIRFLOW_DOWNSAMPLE * (width / K_AIRFLOW_DOWNSAMPLE) + c / K_AIRFLOW_DOWNSAMPLE; }
         int idx_air(ivec2 v) { return idx_air(v.x, v.y); }
+        bool is_solid(ivec2 v) { return in_bound(v) && solid.test(idx(v)); }
+
+        void add_solid(ivec2 pos, float heat) {
+            int im = idx(pos);
+            if (solid.test(im)) return;
+            solid.bits[im >> 6] |= uint64_t(1) << (im & 63);
+            solid.heat[im] = heat;
+            solid.cells.push_back(im);
+            if (bound_dist(pos) > 2) {
+                int im_air = idx_air(pos);
+                if (solid.air_count[im_air]++ == 0) solid.air_cells.push_back(im_air);
+                if (solid.air_count[im_air] == K_AIRFLOW_DOWNSAMPLE * K_AIRFLOW_DOWNSAMPLE) {
+                    solid.air_solid[im_air] = 1;
+                    solid.air_solid_changed = true;
+                }
+            }
+        }
 
         void prepare() {
             state_next.reset(state_cur.particles);
@@ -113,6 +157,7 @@ namespace Simflow {
                 state_next.p_vel[i] = state_cur.p_vel[i];
                 state_next.p_movement[i] = vec2();
                 state_next.p_heat[i] = state_cur.p_heat[i];
+                state_next.p_sleep[i] = state_cur.p_sleep[i];
             }
         }
 
@@ -129,10 +174,14 @@ namespace Simflow {
 
 #pragma region 温度计算
 
-        float average_heat(const vector<float> & heat, ivec2 ipos_near, float& weight) {
+        float average_heat(const vector<float> & heat, const vector<float> & solid_heat, ivec2 ipos_near, float& weight) {
             weight = 0.0;
             if (in_bound(ipos_near)) {//是否在画布里
                 int im1 = idx(ipos_near);//得到它在画布上的index
+                if (solid.test(im1)) {
+                    weight = 1;
+                    return solid_heat[im1];
+                }
                 PixelParticleList& list = state_cur.map_index[im1];//找到该像素点的所有粒子编号
                 if (!list.nil()) {//该像素点不为空
                     float avg = 0.0f;
@@ -162,47 +211,302 @@ namespace Simflow {
             void swap() {
                 std::swap(im_heat, im_heat0);
             }
-        } heat_buf;
+        } heat_buf, solid_heat_buf; // solid_heat_buf 按画布下标
+
+        // 与邻居的平均温度之差，邻居包括上下左右的粒子与固体
+        float heat_delta(ivec2 ipos, float cur_heat) {
+            ivec2 ipos1 = ivec2(ipos.x, ipos.y - 1);
+            ivec2 ipos2 = ivec2(ipos.x, ipos.y + 1);
+            ivec2 ipos3 = ivec2(ipos.x - 1, ipos.y);
+            ivec2 ipos4 = ivec2(ipos.x + 1, ipos.y);
+            float w[4], t[4];
+            t[0] = average_heat(heat_buf.im_heat0, solid_heat_buf.im_heat0, ipos1, w[0]);
+            t[1] = average_heat(heat_buf.im_heat0, solid_heat_buf.im_heat0, ipos2, w[1]);
+            t[2] = average_heat(heat_buf.im_heat0, solid_heat_buf.im_heat0, ipos3, w[2]);
+            t[3] = average_heat(heat_buf.im_heat0, solid_heat_buf.im_heat0, ipos4, w[3]);
+            float w_sum = 0;
+            float wt_sum = 0;
+            for (int i = 0; i < 4; i++) {
+                w_sum += w[i];
+                wt_sum += w[i] * t[i];
+            }
+            return w_sum > 0.0f ? (wt_sum / (w_sum)-cur_heat) : 0;
+        }
 
 
-        void compute_heat() {
+        // 推进 dt 的温度计算所用的迭代次数：至少 K_HEAT_ITERATIONS，
+        // 且每次迭代的步长乘导热系数（铁最大）不超过 K_HEAT_MAX_RATE，否则迭代会振荡
+        // 实际只运行其中的 1 / heat_slowdown，步长不变，见 heat_slowdown
+        int heat_iterations(float dt) {
+            int n = int(ceil(dt * particle_diff(ParticleType::Iron) / K_HEAT_MAX_RATE));
+            return std::max(K_HEAT_ITERATIONS, n);
+        }
+
+        void compute_heat(float dt) {
+            if (heat_solver == HeatSolver::Grid) {
+                compute_heat_grid(dt);
+            }
+            else {
+                compute_heat_particles(dt);
+            }
+        }
+
+        void compute_heat_particles(float dt) {
             heat_buf.reset(state_cur.particles);
             for (int ip = 0; ip < state_cur.particles; ip++) {
                 heat_buf.im_heat[ip] = state_cur.p_heat[ip];
             }
+            solid_heat_buf.reset(width * height);
+            for (int im : solid.cells) {
+                solid_heat_buf.im_heat[im] = solid_heat_buf.im_heat0[im] = solid.heat[im];
+            }
 
             // 对于每个粒子，查找其附近的粒子，计算下一帧的温度
             //对于每个粒子，计算其温度简化为其自身温度和加上上下左右粒子温度差值的平均值
-            for (int ik = 0; ik < K_HEAT_ITERATIONS; ik++) {
+            // 所有温度的变化都不超过 K_HEAT_TOLERANCE 时提前结束
+            const int full = heat_iterations(dt);
+            const float step = dt / full;
+            const int iterations = (full + heat_slowdown - 1) / heat_slowdown;
+            for (int ik = 0; ik < iterations; ik++) {
                 heat_buf.swap();
+                solid_heat_buf.swap();
 
+                float change = 0;
                 for (int ip = 0; ip < state_cur.particles; ip++) {
                     //get map index
                     ivec2 ipos = f2i(state_cur.p_pos[ip]);
-                    int im = idx(ipos);
-                    ivec2 ipos1 = ivec2(ipos.x, ipos.y - 1);
-                    ivec2 ipos2 = ivec2(ipos.x, ipos.y + 1);
-                    ivec2 ipos3 = ivec2(ipos.x - 1, ipos.y);
-                    ivec2 ipos4 = ivec2(ipos.x + 1, ipos.y);
-                    float w[4], t[4];
-                    t[0] = average_heat(heat_buf.im_heat0, ipos1, w[0]);
-                    t[1] = average_heat(heat_buf.im_heat0, ipos2, w[1]);
-                    t[2] = average_heat(heat_buf.im_heat0, ipos3, w[2]);
-                    t[3] = average_heat(heat_buf.im_heat0, ipos4, w[3]);
-                    float w_sum = 0;
-                    float wt_sum = 0;
-                    for (int i = 0; i < 4; i++) {
-                        w_sum += w[i];
-                        wt_sum += w[i] * t[i];
-                    }
-                    float delt_t = w_sum > 0.0f ? (wt_sum / (w_sum)-heat_buf.im_heat0[ip]) : 0;
-                    heat_buf.im_heat[ip] = K_DT / K_HEAT_ITERATIONS * particle_diff(state_cur.p_type[ip]) * delt_t + heat_buf.im_heat0[ip];
+                    float delt_t = heat_delta(ipos, heat_buf.im_heat0[ip]);
+                    heat_buf.im_heat[ip] = step * particle_diff(state_cur.p_type[ip]) * delt_t + heat_buf.im_heat0[ip];
+                    change = std::max(change, abs(heat_buf.im_heat[ip] - heat_buf.im_heat0[ip]));
+                }
+                for (int im : solid.cells) {
+                    ivec2 ipos = ivec2(im % width, im / width);
+                    float delt_t = heat_delta(ipos, solid_heat_buf.im_heat0[im]);
+                    solid_heat_buf.im_heat[im] = step * particle_diff(ParticleType::Iron) * delt_t + solid_heat_buf.im_heat0[im];
+                    change = std::max(change, abs(solid_heat_buf.im_heat[im] - solid_heat_buf.im_heat0[im]));
                 }
+                if (change <= K_HEAT_TOLERANCE) break;
             }
 
             for (int ip = 0; ip < state_cur.particles; ip++) {
                 state_next.p_heat[ip] = heat_buf.im_heat[ip];
             }
+            for (int im : solid.cells) {
+                solid.heat[im] = solid_heat_buf.im_heat[im];
+            }
+        }
+
+        // 网格法的逐像素数据，四周各留一圈空像素，下标为 grid_idx(x, y)
+        // 同一像素内粒子的平均温度按与 compute_heat_particles 相同的规则迭代；
+        // 像素内各粒子与平均温度之差每次迭代按同一比例衰减，写回时据此还原各粒子的温度
+        struct HeatGrid {
+            vector<float> heat, heat0; // 像素内粒子的平均温度，固体像素为其温度
+            vector<float> weight; // 像素内粒子数，固体像素为 1，空像素为 0
+            vector<float> rate; // 每次迭代向邻居平均温度靠拢的比例，邻居全空时为 0
+            vector<float> inv_weight_sum; // 上下左右像素 weight 之和的倒数
+            vector<int> p_cell; // 粒子所在像素的网格下标，位于固体像素内时为 -1
+            vector<float> p_offset; // 粒子温度与所在像素平均温度之差
+            vector<int> buried; // 位于固体像素内的粒子：邻居只看到固体，它们单独迭代
+            vector<float> buried_heat;
+            // 活跃块：边长 K_HEAT_TILE 的像素块，块下标按行优先
+            vector<int> active, next_active;
+            vector<float> tile_change; // 本次迭代块内温度的最大变化
+            vector<char> tile_next; // 是否已加入 next_active
+            int iterations = 0; // 本帧实际执行的迭代次数
+            int x0, x1, y0, y1; // 非空像素的包围盒
+            void resize(int n) {
+                heat.resize(n);
+                heat0.resize(n);
+                weight.resize(n);
+                rate.resize(n);
+                inv_weight_sum.resize(n);
+            }
+        } heat_grid;
+
+        int grid_idx(int x, int y) { return (y + 1) * (width + 2) + x + 1; }
+        int grid_idx(ivec2 v) { return grid_idx(v.x, v.y); }
+
+        void compute_heat_grid(float dt) {
+            HeatGrid& g = heat_grid;
+            const int full = heat_iterations(dt);
+            const float step = dt / full;
+            const int iterations = (full + heat_slowdown - 1) / heat_slowdown;
+            g.resize((width + 2) * (height + 2));
+            g.x0 = width, g.x1 = -1, g.y0 = height, g.y1 = -1;
+            auto extend = [&g](ivec2 p) {
+                g.x0 = std::min(g.x0, p.x);
+                g.x1 = std::max(g.x1, p.x);
+                g.y0 = std::min(g.y0, p.y);
+                g.y1 = std::max(g.y1, p.y);
+            };
+            g.p_cell.resize(state_cur.particles);
+            g.buried.clear();
+            g.buried_heat.clear();
+            for (int ip = 0; ip < state_cur.particles; ip++) {
+                ivec2 pos = f2i(state_cur.p_pos[ip]);
+                extend(pos);
+                g.p_cell[ip] = grid_idx(pos);
+                if (solid.test(idx(pos))) {
+                    g.p_cell[ip] = -1;
+                    g.buried.push_back(ip);
+                    g.buried_heat.push_back(state_cur.p_heat[ip]);
+                }
+            }
+            for (int im : solid.cells) {
+                extend(ivec2(im % width, im / width));
+            }
+            if (g.x0 > g.x1) return;
+
+            // 只清空包围盒及外面一圈，迭代时只会读到这些像素
+            for (int y = g.y0 - 1; y <= g.y1 + 1; y++) {
+                int from = grid_idx(g.x0 - 1, y), to = grid_idx(g.x1 + 1, y) + 1;
+                fill(g.heat0.begin() + from, g.heat0.begin() + to, 0.f);
+                fill(g.weight.begin() + from, g.weight.begin() + to, 0.f);
+                fill(g.rate.begin() + from, g.rate.begin() + to, 0.f);
+            }
+
+            // 粒子 -> 网格：累加温度、个数与导热系数，再取平均
+            for (int ip = 0; ip < state_cur.particles; ip++) {
+                int ig = g.p_cell[ip];
+                if (ig < 0) continue;
+                g.heat0[ig] += state_cur.p_heat[ip];
+                g.weight[ig] += 1;
+                g.rate[ig] += particle_diff(state_cur.p_type[ip]);
+            }
+            for (int y = g.y0; y <= g.y1; y++) {
+                for (int ig = grid_idx(g.x0, y); ig <= grid_idx(g.x1, y); ig++) {
+                    if (g.weight[ig] > 0) {
+                        g.heat0[ig] /= g.weight[ig];
+                        g.rate[ig] /= g.weight[ig];
+                    }
+                }
+            }
+            for (int im : solid.cells) {
+                int ig = grid_idx(im % width, im / width);
+                g.heat0[ig] = solid.heat[im];
+                g.weight[ig] = 1;
+                g.rate[ig] = particle_diff(ParticleType::Iron);
+            }
+            g.p_offset.resize(state_cur.particles);
+            for (int ip = 0; ip < state_cur.particles; ip++) {
+                g.p_offset[ip] = g.p_cell[ip] < 0 ? 0 : state_cur.p_heat[ip] - g.heat0[g.p_cell[ip]];
+            }
+            const int stride = width + 2;
+            for (int y = g.y0; y <= g.y1; y++) {
+                for (int ig = grid_idx(g.x0, y); ig <= grid_idx(g.x1, y); ig++) {
+                    float w_sum = g.weight[ig - 1] + g.weight[ig + 1] + g.weight[ig - stride] + g.weight[ig + stride];
+                    g.inv_weight_sum[ig] = w_sum > 0 ? 1 / w_sum : 0;
+                    g.rate[ig] = w_sum > 0 ? step * g.rate[ig] : 0;
+                }
+            }
+            g.heat = g.heat0;
+
+            // 迭代：只处理活跃块，块内各行连续访问，可以向量化
+            // 第一次迭代处理包围盒内的全部块；变化超过 K_HEAT_TOLERANCE 的块及其上下左右的块在下次迭代中活跃，
+            // 没有活跃块时提前结束。不活跃的块两组缓冲的值相同
+            int tiles_x = (width + K_HEAT_TILE - 1) / K_HEAT_TILE;
+            int tiles_y = (height + K_HEAT_TILE - 1) / K_HEAT_TILE;
+            g.tile_change.resize(tiles_x * tiles_y);
+            g.tile_next.assign(tiles_x * tiles_y, 0);
+            g.active.clear();
+            for (int ty = g.y0 / K_HEAT_TILE; ty <= g.y1 / K_HEAT_TILE; ty++) {
+                for (int tx = g.x0 / K_HEAT_TILE; tx <= g.x1 / K_HEAT_TILE; tx++) {
+                    g.active.push_back(ty * tiles_x + tx);
+                }
+            }
+            // 块 it 与包围盒的交集
+            auto tile_rect = [this, &g, tiles_x](int it, int& x0, int& x1, int& y0, int& y1) {
+                x0 = std::max(g.x0, it % tiles_x * K_HEAT_TILE);
+                x1 = std::min(g.x1, it % tiles_x * K_HEAT_TILE + K_HEAT_TILE - 1);
+                y0 = std::max(g.y0, it / tiles_x * K_HEAT_TILE);
+                y1 = std::min(g.y1, it / tiles_x * K_HEAT_TILE + K_HEAT_TILE - 1);
+            };
+            g.iterations = 0;
+            for (int ik = 0; ik < iterations; ik++) {
+                if (!g.active.empty()) {
+                    g.iterations++;
+                    parallel_line.parallel_for(0, int(g.active.size()), 1, [this, &g, &tile_rect, stride](int from, int to) {
+                        const float* t = g.heat0.data();
+                        const float* w = g.weight.data();
+                        const float* rate = g.rate.data();
+                        const float* inv = g.inv_weight_sum.data();
+                        float* out = g.heat.data();
+                        for (int i = from; i < to; i++) {
+                            int x0, x1, y0, y1;
+                            tile_rect(g.active[i], x0, x1, y0, y1);
+                            float change = 0;
+                            for (int y = y0; y <= y1; y++) {
+                                int ig0 = grid_idx(x0, y), ig1 = grid_idx(x1, y);
+                                for (int ig = ig0; ig <= ig1; ig++) {
+                                    float sum = w[ig - 1] * t[ig - 1] + w[ig + 1] * t[ig + 1] + w[ig - stride] * t[ig - stride] + w[ig + stride] * t[ig + stride];
+                                    float delta = rate[ig] * (sum * inv[ig] - t[ig]);
+                                    out[ig] = t[ig] + delta;
+                                    change = std::max(change, abs(delta));
+                                }
+                            }
+                            g.tile_change[g.active[i]] = change;
+                        }
+                    });
+                }
+                for (int i = 0; i < int(g.buried.size()); i++) {
+                    int ip = g.buried[i];
+                    int ig = grid_idx(f2i(state_cur.p_pos[ip]));
+                    if (g.inv_weight_sum[ig] == 0) continue;
+                    const float* t = g.heat0.data();
+                    const float* w = g.weight.data();
+                    float sum = w[ig - 1] * t[ig - 1] + w[ig + 1] * t[ig + 1] + w[ig - stride] * t[ig - stride] + w[ig + stride] * t[ig + stride];
+                    g.buried_heat[i] += step * particle_diff(state_cur.p_type[ip]) * (sum * g.inv_weight_sum[ig] - g.buried_heat[i]);
+                }
+                if (g.active.empty()) continue;
+
+                g.next_active.clear();
+                auto activate = [&g](int it) {
+                    if (!g.tile_next[it]) {
+                        g.tile_next[it] = 1;
+                        g.next_active.push_back(it);
+                    }
+                };
+                for (int it : g.active) {
+                    if (g.tile_change[it] <= K_HEAT_TOLERANCE) continue;
+                    int tx = it % tiles_x, ty = it / tiles_x;
+                    activate(it);
+                    if (tx > g.x0 / K_HEAT_TILE) activate(it - 1);
+                    if (tx < g.x1 / K_HEAT_TILE) activate(it + 1);
+                    if (ty > g.y0 / K_HEAT_TILE) activate(it - tiles_x);
+                    if (ty < g.y1 / K_HEAT_TILE) activate(it + tiles_x);
+                }
+                // 本次处理过、下次不再活跃的块，把新值也写入另一组缓冲
+                for (int it : g.active) {
+                    if (g.tile_next[it]) continue;
+                    int x0, x1, y0, y1;
+                    tile_rect(it, x0, x1, y0, y1);
+                    for (int y = y0; y <= y1; y++) {
+                        copy(g.heat.begin() + grid_idx(x0, y), g.heat.begin() + grid_idx(x1, y) + 1, g.heat0.begin() + grid_idx(x0, y));
+                    }
+                }
+                for (int it : g.next_active) {
+                    g.tile_next[it] = 0;
+                }
+                std::swap(g.active, g.next_active);
+                std::swap(g.heat, g.heat0);
+            }
+
+            // 网格 -> 粒子
+            // 像素内只有一个粒子时 p_offset 为 0，不必计算衰减
+            for (int ip = 0; ip < state_cur.particles; ip++) {
+                int ig = g.p_cell[ip];
+                if (ig < 0) continue;
+                state_next.p_heat[ip] = g.heat0[ig];
+                if (g.p_offset[ip] != 0) {
+                    state_next.p_heat[ip] += pow(1 - g.rate[ig], iterations) * g.p_offset[ip];
+                }
+            }
+            for (int i = 0; i < int(g.buried.size()); i++) {
+                state_next.p_heat[g.buried[i]] = g.buried_heat[i];
+            }
+            for (int im : solid.cells) {
+                solid.heat[im] = g.heat0[grid_idx(im % width, im / width)];
+            }
         }
 
 #pragma endregion
@@ -211,34 +515,24 @@ namespace Simflow {
 
         void compute_vel() {
             compute_vel_all();
-            constraint_solid();
         }
 
-        void constraint_solid() {
-            for (int ip = 0; ip < state_cur.particles; ip++) {
-                ParticleType cur_type = state_cur.p_type[ip];
-                if (cur_type == ParticleType::Iron) {
-                    state_next.p_vel[ip] = vec2();
-                }
-            }
+        bool sleeping(int ip) {
+            return state_cur.p_sleep[ip] >= K_SLEEP_FRAMES;
         }
 
         vec2 sample_acc_air_g(int ip) {
             ParticleType cur_type = state_cur.p_type[ip];
-            if (cur_type == ParticleType::Iron) return vec2();
 
             state_next.p_vel[ip] = state_cur.p_vel[ip];
 
             // get map index
             ivec2 ipos = f2i(state_cur.p_pos[ip]);
-            int im = idx(ipos);
-            int im_air = idx_air(ipos);
-
             vec2 v_air = bilinear_sample_air_v(ipos);
 
             vec2 v_p = state_cur.p_vel[ip]; // particle velocity
             vec2 v_rel = v_p - v_air; // relative velocity
-            float p = airflow_solver.p[im_air]; // air pressure
+            float p = safe_sample_air_p(ipos / K_AIRFLOW_DOWNSAMPLE); // air pressure
             p = glm::max(0.f, 1 + p / 5);
             float mass = particle_mass(cur_type);
 
@@ -258,12 +552,14 @@ namespace Simflow {
             vector<vec2> p_im_pos0;
             vector<vec2> p_im_vel;
             vector<vec2> p_im_vel0;
+            vector<float> p_acc; // 水粒子在最后一个子步中的加速度大小
 
             void reset_p(int n_all) {
                 p_im_pos.resize(n_all);
                 p_im_pos0.resize(n_all);
                 p_im_vel.resize(n_all);
                 p_im_vel0.resize(n_all);
+                p_acc.resize(n_all);
             }
             void swap() {
                 std::swap(p_im_pos, p_im_pos0);
@@ -271,102 +567,284 @@ namespace Simflow {
             }
         } liquid_buf;
 
-        template<typename F>
-        void iterate_neighbor_particles(ivec2 pos, int r_neibor, F f) {
-            for (int dy = -r_neibor; dy <= r_neibor; dy++) {
-                for (int dx = r_neibor; dx >= -r_neibor; dx--) {
+        WaterKernelTable water_kernel;
+        float liquid_acc = 0; // 上一帧水粒子加速度的 K_LIQUID_CFL_PERCENTILE 分位数
+        bool liquid_acc_known = false; // 上一帧有未休眠的水，且此后没有加入新的水
+        int liquid_substep_hold = 0; // 可以减少子步数的连续帧数
+        vector<float> liquid_samples;
+
+        // 粒子按画布下标排序，因此若干行像素对应一段连续的粒子区间 [from, to)
+        struct ParticleTile {
+            int from, to;
+            int awake; // 区间内未休眠的粒子数
+        };
+        vector<ParticleTile> row_tiles;
+
+        // 按 K_LIQUID_TILE_ROWS 行一组将 state_cur 切分为若干区间
+        void build_row_tiles() {
+            row_tiles.clear();
+            int from = 0;
+            for (int row = K_LIQUID_TILE_ROWS; from < state_cur.particles; row += K_LIQUID_TILE_ROWS) {
+                int to = state_cur.particles;
+                if (row < height) {
+                    auto first = partition_point(state_cur.p_pos.begin() + from, state_cur.p_pos.begin() + state_cur.particles,
+                        [this, row](const vec2& p) { return f2i(p).y < row; });
+                    to = int(first - state_cur.p_pos.begin());
+                }
+                if (to > from) {
+                    row_tiles.push_back(ParticleTile{ from, to, 0 });
+                }
+                from = to;
+            }
+            parallel_line.parallel_for(0, int(row_tiles.size()), 1, [this](int from, int to) {
+                for (int it = from; it < to; it++) {
+                    ParticleTile& tile = row_tiles[it];
+                    for (int ip = tile.from; ip < tile.to; ip++) {
+                        tile.awake += !sleeping(ip);
+                    }
+                }
+            });
+        }
+
+        // 液体粒子的邻居表（CSR），与每个子步遍历像素邻域得到的邻居相同：
+        // 帧初（state_cur.map_index）所在像素与 ip 当前像素的偏移满足 dx * dx + dy * dy <= r * r 的粒子与固体像素，r = neighbor_radius()
+        // 建表时按 r + K_LIQUID_SKIN 收录候选，子步中再按当前像素筛选；任一粒子的像素离建表时超过 K_LIQUID_SKIN 时，表内可能缺少邻居，需要重建
+        struct NeighborList {
+            // 每个行块一张表，行块内第 i 个粒子（下标 tile.from + i）的邻居为：
+            // 粒子 index[offset[i], offset[i + 1])，固体 solid_pos[solid_offset[i], solid_offset[i + 1])
+            struct Tile {
+                vector<int> offset;
+                vector<int> index;
+                vector<float> mass;
+                vector<ivec2> pixel; // 邻居帧初所在的像素
+                vector<int> solid_offset;
+                vector<ivec2> solid_pos;
+                vector<int> solid_key; // 固体像素画布下标取反，用于重合时的随机方向
+                vector<float> gather_x, gather_y, gather_mass; // 子步中单个粒子的邻居相对位移与质量，交给 water_force
+            };
+            vector<Tile> tiles;
+            vector<ivec2> build_pixel; // 建表时所在的像素
+            int builds = 0; // 本帧建表次数
+        } neighbor_list;
+
+        bool has_neighbor_list(int ip) {
+            return state_cur.p_type[ip] == ParticleType::Water && !sleeping(ip);
+        }
+
+        // 像素邻域的半径
+        static int neighbor_radius() {
+            return f2i(ceilf(K_LIQUID_RADIUS));
+        }
+
+        // 枚举帧初位于 pos 的像素邻域 dx * dx + dy * dy <= r * r 内的粒子（ip 除外）与固体像素
+        template<typename FP, typename FS>
+        void visit_neighbor_candidates(int ip, ivec2 pos, int r, FP fp, FS fs) {
+            for (int dy = -r; dy <= r; dy++) {
+                for (int dx = r; dx >= -r; dx--) {
                     ivec2 n_pos = pos + ivec2(dx, dy);
                     if (!in_bound(n_pos)) continue;
-                    if (dx * dx + dy * dy > r_neibor * r_neibor) continue;
-                    PixelParticleList & lst = state_cur.map_index[idx(n_pos)];
-                    if (!lst.nil()) {
-                        for (int t_ip = lst.from; t_ip <= lst.to; t_ip++) {
-                            f(t_ip);
-                        }
+                    if (dx * dx + dy * dy > r * r) continue;
+                    int im = idx(n_pos);
+                    if (solid.test(im)) fs(n_pos);
+                    const PixelParticleList& lst = state_cur.map_index[im];
+                    if (lst.nil()) continue;
+                    for (int t_ip = lst.from; t_ip <= lst.to; t_ip++) {
+                        if (t_ip != ip) fp(t_ip, n_pos);
                     }
                 }
             }
         }
 
-        template<typename F>
-        void iterate_neighbor_liquid(ivec2 pos, int r_neighbor, F & f) {
-            ivec2 bfrom = (pos - ivec2(r_neighbor)) / K_LIQUID_GRID_DOWNSAMPLE;
-            ivec2 bto = (pos + ivec2(r_neighbor)) / K_LIQUID_GRID_DOWNSAMPLE;
-            bfrom = max(ivec2(0, 0), bfrom);
-            bto = min(ivec2(width, height) / K_LIQUID_GRID_DOWNSAMPLE - 1, bto);
-            for (int by = bfrom.y; by <= bto.y; by++) {
-                for (int bx = bfrom.x; bx <= bto.x; bx++) {
-                    int b_pos = by * (width / K_LIQUID_GRID_DOWNSAMPLE) + bx;
-                    for (int ip_liquid : state_cur.map_block_liquid[b_pos].idx_lp) {
-                        f(ip_liquid);
+        // 以 liquid_buf.p_im_pos0 所在的像素为中心为第 it 个行块建表
+        void build_neighbor_list(int it) {
+            const ParticleTile& tile = row_tiles[it];
+            auto& nt = neighbor_list.tiles[it];
+            int r_list = neighbor_radius() + K_LIQUID_SKIN;
+            nt.offset.assign(tile.to - tile.from + 1, 0);
+            nt.solid_offset.assign(tile.to - tile.from + 1, 0);
+            nt.index.clear();
+            nt.mass.clear();
+            nt.pixel.clear();
+            nt.solid_pos.clear();
+            nt.solid_key.clear();
+            for (int ip = tile.from; ip < tile.to; ip++) {
+                if (has_neighbor_list(ip)) {
+                    ivec2 pos = f2i(liquid_buf.p_im_pos0[ip]);
+                    neighbor_list.build_pixel[ip] = pos;
+                    visit_neighbor_candidates(ip, pos, r_list, [this, &nt](int t_ip, ivec2 t_pos) {
+                        nt.index.push_back(t_ip);
+                        nt.mass.push_back(particle_mass(state_cur.p_type[t_ip]));
+                        nt.pixel.push_back(t_pos);
+                    }, [this, &nt](ivec2 t_pos) {
+                        nt.solid_pos.push_back(t_pos);
+                        nt.solid_key.push_back(~idx(t_pos));
+                    });
+                }
+                nt.offset[ip - tile.from + 1] = int(nt.index.size());
+                nt.solid_offset[ip - tile.from + 1] = int(nt.solid_pos.size());
+            }
+        }
+
+        bool neighbor_list_stale() {
+            int n_far = parallel_line.parallel_reduce(0, state_cur.particles, K_SORT_GRAIN, 0, [this](int from, int to) {
+                int cnt = 0;
+                for (int ip = from; ip < to; ip++) {
+                    if (!has_neighbor_list(ip)) continue;
+                    ivec2 disp = f2i(liquid_buf.p_im_pos0[ip]) - neighbor_list.build_pixel[ip];
+                    cnt += disp.x * disp.x + disp.y * disp.y > K_LIQUID_SKIN * K_LIQUID_SKIN;
+                }
+                return cnt;
+            }, [](int a, int b) { return a + b; });
+            return n_far > 0;
+        }
+
+        // 对第 it 个行块内的粒子执行第 ik 个子步
+        // 只读取 liquid_buf 的 *0 缓冲，只写入本行块的 liquid_buf 当前缓冲，因此各行块可以并行
+        void liquid_substep(int it, int ik) {
+            const ParticleTile& tile = row_tiles[it];
+            auto& nt = neighbor_list.tiles[it];
+            for (int ip = tile.from; ip < tile.to; ip++) {
+                vec2 acc = vec2();
+                ParticleType cur_type = state_cur.p_type[ip];
+                if (sleeping(ip)) continue;
+                float mass = particle_mass(cur_type);
+                if (cur_type == ParticleType::Water) {
+                    // 邻居的相对位移与质量收集到连续数组后由 water_force 批量计算
+                    vec2 pos = liquid_buf.p_im_pos0[ip];
+                    int i = ip - tile.from;
+                    int n_max = nt.offset[i + 1] - nt.offset[i] + nt.solid_offset[i + 1] - nt.solid_offset[i];
+                    if (int(nt.gather_x.size()) < n_max) {
+                        nt.gather_x.resize(n_max);
+                        nt.gather_y.resize(n_max);
+                        nt.gather_mass.resize(n_max);
+                    }
+                    int cnt = 0;
+                    vec2 f = vec2();
+                    // t_key 区分邻居：粒子为其下标，固体为画布下标取反
+                    auto gather = [&](vec2 pos_diff, float t_mass, int t_key) {
+                        if (dot(pos_diff, pos_diff) <= 0.0001f) {
+                            // 防止normalize零向量
+                            // 此处随机给一个方向（由粒子对与子步决定，与线程调度无关）
+                            float r = length(pos_diff);
+                            unsigned int seed = hash_combine(hash_combine(frame_counter * K_LIQUID_ITERATIONS + ik, ip), t_key);
+                            pos_diff = vec2(hash_random(seed, -1, 1), hash_random(seed + 1, -1, 1));
+                            f += -normalize(pos_diff) * t_mass * kernel_fn_water(r / K_LIQUID_RADIUS);
+                            return;
+                        }
+                        nt.gather_x[cnt] = pos_diff.x;
+                        nt.gather_y[cnt] = pos_diff.y;
+                        nt.gather_mass[cnt] = t_mass;
+                        cnt++;
+                    };
+                    // 表内候选只取当前像素邻域内的
+                    ivec2 cur_pixel = f2i(pos);
+                    int r2 = neighbor_radius() * neighbor_radius();
+                    auto in_stencil = [cur_pixel, r2](ivec2 t_pos) {
+                        ivec2 d = t_pos - cur_pixel;
+                        return d.x * d.x + d.y * d.y <= r2;
+                    };
+                    for (int k = nt.offset[i]; k < nt.offset[i + 1]; k++) {
+                        if (!in_stencil(nt.pixel[k])) continue;
+                        gather(liquid_buf.p_im_pos0[nt.index[k]] - pos, nt.mass[k], nt.index[k]);
                     }
+                    float solid_mass = particle_mass(ParticleType::Iron);
+                    for (int k = nt.solid_offset[i]; k < nt.solid_offset[i + 1]; k++) {
+                        if (!in_stencil(nt.solid_pos[k])) continue;
+                        gather(vec2(nt.solid_pos[k]) - pos, solid_mass, nt.solid_key[k]);
+                    }
+                    f += water_force(water_kernel, nt.gather_x.data(), nt.gather_y.data(), nt.gather_mass.data(), cnt);
+                    acc = f / mass;
+                }
+                float ratio = length(acc) / K_LIQUID_MAX_ACC;
+                if (ratio > 1.f) {
+                    acc /= ratio;
                 }
+                acc += sample_acc_air_g(ip);
+                if (cur_type == ParticleType::Water) {
+                    liquid_buf.p_acc[ip] = length(acc);
+                }
+
+                liquid_buf.p_im_vel[ip] = liquid_buf.p_im_vel0[ip] + acc * K_DT / float(liquid_substeps);
+                liquid_buf.p_im_pos[ip] = liquid_buf.p_im_pos0[ip] + liquid_buf.p_im_vel[ip] * K_DT / float(liquid_substeps);
             }
         }
 
-        inline float kernel_fn_water(float dist) {
-            return 180 * pow(K_LIQUID_RADIUS - dist, 2);
+        // values 的 q 分位数（0 <= q <= 1），会打乱 values 的顺序；为空时返回 0
+        static float percentile(vector<float>& values, float q) {
+            if (values.empty()) return 0;
+            auto nth = values.begin() + int(q * (values.size() - 1));
+            nth_element(values.begin(), nth, values.end());
+            return *nth;
         }
-        
+
+        // 子步数 n 使水粒子在一个子步 dt = K_DT / n 内的位移 v dt + a dt^2 / 2 不超过 K_LIQUID_CFL * K_LIQUID_RADIUS，
+        // 限制在 [1, liquid_iterations]。其余粒子不受 SPH 力，子步数不影响其稳定性
+        int liquid_substep_count(float v, float a) {
+            float d = K_LIQUID_CFL * K_LIQUID_RADIUS;
+            float dt = a > EPS ? (sqrt(v * v + 2 * a * d) - v) / a : d / std::max(v, EPS);
+            float n = dt > 0 ? K_DT / dt : float(liquid_iterations);
+            return clamp(int(ceil(std::min(n, float(liquid_iterations)))), 1, liquid_iterations);
+        }
+
         void compute_vel_all() {
             // 1. 所有粒子计算SPH应力（优化：液体附近粒子）
             // 2. 各个粒子加速度累加到state_next上
-            int r_neibor = f2i(ceilf(K_LIQUID_RADIUS));
             liquid_buf.reset_p(state_cur.particles);
 
+            // 两组缓冲都初始化，休眠粒子不参与子步计算，其位置在各子步中保持不变
+            liquid_samples.clear();
             for (int ip = 0; ip < state_cur.particles; ip++) {
-                liquid_buf.p_im_pos[ip] = state_cur.p_pos[ip];
-                liquid_buf.p_im_vel[ip] = state_cur.p_vel[ip];
+                liquid_buf.p_im_pos[ip] = liquid_buf.p_im_pos0[ip] = state_cur.p_pos[ip];
+                liquid_buf.p_im_vel[ip] = liquid_buf.p_im_vel0[ip] = state_cur.p_vel[ip];
+                if (has_neighbor_list(ip)) {
+                    liquid_samples.push_back(length(state_cur.p_vel[ip]));
+                }
             }
 
-            for (int ik = 0; ik < K_LIQUID_ITERATIONS; ik++) {
-                liquid_buf.swap();
-
-                for (int ip = 0; ip < state_cur.particles; ip++) {
-                    vec2 acc = vec2();
-                    ivec2 pos = f2i(liquid_buf.p_im_pos0[ip]);
-                    ParticleType cur_type = state_cur.p_type[ip];
-                    if (cur_type == ParticleType::Iron) continue;
-                    float mass = particle_mass(cur_type);
-                    iterate_neighbor_particles(pos, r_neibor, [this, mass, &ip, &acc](int t_ip) {
-                        ParticleType cur_type = state_cur.p_type[ip];
-                        ParticleType t_type = state_cur.p_type[t_ip];
-                        if (cur_type != ParticleType::Water) return;
-
-                        vec2 f_press = vec2();
-                        vec2 f_visc = vec2();
-                        if (t_ip == ip) return;
-
-                        vec2 pos_diff = liquid_buf.p_im_pos0[t_ip] - liquid_buf.p_im_pos0[ip];
-                        vec2 vel_diff = liquid_buf.p_im_vel0[t_ip] - liquid_buf.p_im_vel0[ip];
-
-                        float t_mass = particle_mass(state_cur.p_type[t_ip]);
-                        float r = length(pos_diff);
-
-                        if (r <= 0.01) {
-                            // 防止normalize零向量
-                            // 此处随机给一个方向
-                            pos_diff = vec2(random(-1, 1), random(-1, 1));
-                        }
-                        if (r < K_LIQUID_RADIUS)
-                        {
-                            vec2 f_custom = -normalize(pos_diff) * t_mass * kernel_fn_water(r / K_LIQUID_RADIUS);
-                            vec2 f = f_custom;
-                            acc += f / mass;
-                        }
+            // 本帧的子步数：v、a 取未休眠水粒子速度与上一帧加速度的分位数，少数抖动的粒子不决定整帧；
+            // 上一帧的加速度不可用（此前没有未休眠的水，或刚加入了水）时 a 取其上界。没有未休眠的水时只需一步。
+            // 需要更多子步时立即增加，减少则要连续 K_LIQUID_SUBSTEP_HOLD 帧都可以减少，且每次只减一步
+            float v = percentile(liquid_samples, K_LIQUID_CFL_PERCENTILE);
+            float a = liquid_acc_known ? liquid_acc : K_LIQUID_MAX_ACC + K_GRAVITY;
+            int target = liquid_samples.empty() ? 1 : liquid_substep_count(v, a);
+            if (target >= liquid_substeps || liquid_substeps > liquid_iterations || liquid_samples.empty()) {
+                liquid_substeps = target;
+                liquid_substep_hold = 0;
+            }
+            else if (++liquid_substep_hold >= K_LIQUID_SUBSTEP_HOLD) {
+                liquid_substeps--;
+                liquid_substep_hold = 0;
+            }
 
-                    });
-                    float ratio = length(acc) / 100.f;
-                    if (ratio > 1.f) {
-                        acc /= ratio;
+            // 每个子步内各行块并行计算，子步之间同步；邻居表每帧建立一次，粒子离开建表时的像素过远时重建
+            // 建表与随后的子步在同一任务内完成，表项仍在缓存中
+            build_row_tiles();
+            NeighborList& nl = neighbor_list;
+            nl.tiles.resize(row_tiles.size());
+            nl.build_pixel.resize(state_cur.particles);
+            nl.builds = 0;
+            for (int ik = 0; ik < liquid_substeps; ik++) {
+                liquid_buf.swap();
+                bool rebuild = ik == 0 || neighbor_list_stale();
+                nl.builds += rebuild;
+
+                parallel_line.parallel_for(0, int(row_tiles.size()), 1, [this, ik, rebuild](int from, int to) {
+                    for (int it = from; it < to; it++) {
+                        if (row_tiles[it].awake == 0) continue;
+                        if (rebuild) build_neighbor_list(it);
+                        liquid_substep(it, ik);
                     }
-                    acc += sample_acc_air_g(ip);
-
-                    liquid_buf.p_im_vel[ip] = liquid_buf.p_im_vel0[ip] + acc * K_DT / float(K_LIQUID_ITERATIONS);
-                    liquid_buf.p_im_pos[ip] = liquid_buf.p_im_pos0[ip] + liquid_buf.p_im_vel[ip] * K_DT / float(K_LIQUID_ITERATIONS);
+                });
+            }
 
+            liquid_samples.clear();
+            for (int ip = 0; ip < state_cur.particles; ip++) {
+                if (has_neighbor_list(ip)) {
+                    liquid_samples.push_back(liquid_buf.p_acc[ip]);
                 }
             }
+            liquid_acc_known = !liquid_samples.empty();
+            liquid_acc = percentile(liquid_samples, K_LIQUID_CFL_PERCENTILE);
 
             for (int ip = 0; ip < state_cur.particles; ip++) {
                 vec2 pos_delta = liquid_buf.p_im_pos[ip] - state_cur.p_pos[ip];
@@ -380,19 +858,25 @@ namespace Simflow {
 
 #pragma region 气流
 
-        int safe_air_idx(ivec2 p_air) {
+        ivec2 clamp_air_pos(ivec2 p_air) {
             int wlim = width / K_AIRFLOW_DOWNSAMPLE - 1;
             int hlim = height / K_AIRFLOW_DOWNSAMPLE - 1;
-            p_air.x = clamp(p_air.x, 0, wlim);
-            p_air.y = clamp(p_air.y, 0, hlim);
+            return ivec2(clamp(p_air.x, 0, wlim), clamp(p_air.y, 0, hlim));
+        }
+
+        int safe_air_idx(ivec2 p_air) {
+            p_air = clamp_air_pos(p_air);
             return p_air.y * (width / K_AIRFLOW_DOWNSAMPLE) + p_air.x;
         }
 
+        // 读取 save_air_state 保存的快照，而非正在被 compute_air_flow 修改的 airflow_solver
         vec2 safe_sample_air_v(ivec2 p_air) {
+            p_air = clamp_air_pos(p_air);
             return air_vel_buf[p_air.y][p_air.x];
         }
 
         float safe_sample_air_p(ivec2 p_air) {
+            p_air = clamp_air_pos(p_air);
             return air_p_buf[p_air.y][p_air.x];
         }
 
@@ -430,24 +914,35 @@ namespace Simflow {
             return bilinear_sample_air(pos, [this](ivec2 pos) { return safe_sample_air_p(pos); });
         }
 
-        void compute_air_flow() {
+        void compute_air_flow(float dt) {
 
             for (int i = 0; i < state_cur.particles; i++) {
                 ivec2 pos = f2i(state_cur.p_pos[i]);
                 if (bound_dist(pos) <= 2) continue;
+                if (sleeping(i)) continue;
                 int im_air = idx_air(pos);
-                if (state_cur.p_type[i] != ParticleType::Iron) {
-                    vec2 diff = state_cur.p_movement[i] / K_DT - vec2(airflow_solver.getVX()[im_air], airflow_solver.getVY()[im_air]);
-                    airflow_solver.getVX()[im_air] += diff.x / K_AIRFLOW_DOWNSAMPLE / K_AIRFLOW_DOWNSAMPLE;
-                    airflow_solver.getVY()[im_air] += diff.y / K_AIRFLOW_DOWNSAMPLE / K_AIRFLOW_DOWNSAMPLE;
-                }
-                else {
-                    vec2 diff = -vec2(airflow_solver.getVX()[im_air], airflow_solver.getVY()[im_air]);
-                    airflow_solver.getVX()[im_air] += diff.x / K_AIRFLOW_DOWNSAMPLE / K_AIRFLOW_DOWNSAMPLE;
-                    airflow_solver.getVY()[im_air] += diff.y / K_AIRFLOW_DOWNSAMPLE / K_AIRFLOW_DOWNSAMPLE;
-                }
+                vec2 diff = state_cur.p_movement[i] / K_DT - vec2(airflow_solver.getVX()[im_air], airflow_solver.getVY()[im_air]);
+                airflow_solver.getVX()[im_air] += diff.x / K_AIRFLOW_DOWNSAMPLE / K_AIRFLOW_DOWNSAMPLE;
+                airflow_solver.getVY()[im_air] += diff.y / K_AIRFLOW_DOWNSAMPLE / K_AIRFLOW_DOWNSAMPLE;
+                airflow_solver.wake(im_air);
+            }
+
+            // 填满的网格是 AirSolver 的固体格，由求解器挡住气流
+            if (solid.air_solid_changed) {
+                airflow_solver.setSolid(solid.air_solid.data());
+                solid.air_solid_changed = false;
             }
 
+            // 部分被占的网格：每个固体像素每 K_DT 将气流速度衰减 1/(K_AIRFLOW_DOWNSAMPLE^2)，同一网格内 k 个像素合并为一次乘法
+            const float keep = 1 - 1.f / (K_AIRFLOW_DOWNSAMPLE * K_AIRFLOW_DOWNSAMPLE);
+            for (int im_air : solid.air_cells) {
+                if (solid.air_solid[im_air]) continue;
+                float k = pow(keep, solid.air_count[im_air] * dt / K_DT);
+                airflow_solver.getVX()[im_air] *= k;
+                airflow_solver.getVY()[im_air] *= k;
+            }
+
+            airflow_solver.timeStep = dt;
             airflow_solver.animVel();
         }
 
@@ -458,177 +953,587 @@ namespace Simflow {
         struct CollisionDetectionResult {
             vec2 pos;
             int target_index;
+            bool solid; // 撞到静态固体，此时 target_index 为 -1
         };
 
-        bool detect_collision(vec2 start, vec2 end, bool ignore_liquid, CollisionDetectionResult & result) {
-            vec2 final_pos = end;//no collision->to the end
-            int last_target = -1;
+        // 沿线段 start -> end 做网格 DDA（Amanatides & Woo），每个经过的像素只访问一次
+        // 像素 (x, y) 覆盖 [x-0.5, x+0.5) x [y-0.5, y+0.5)，occupancy 的汇总为空时整块跳过。
+        // 进入第一个被占用的像素（起点像素除外）即发生碰撞，从入口沿路径后退半个像素（不超过上一段的中点）停下，
+        // 该点仍在起点像素内或落在被占用的像素上时停在原地；离开画布时停在终点
+        // seed 用于在目标像素内选择被碰撞的粒子，由调用方给出以保证结果与执行顺序无关
+        bool detect_collision(vec2 start, vec2 end, bool ignore_liquid, unsigned int seed, CollisionDetectionResult & result) {
+            result.pos = end;//no collision->to the end
+            result.target_index = -1;
+            result.solid = false;
+
+            vec2 d = end - start;
+            if (d == vec2()) return false;
+
+            vec2 o = start + vec2(0.5f); // 以像素左上角为原点的坐标
+            ivec2 start_cell = ivec2(floor(o));
+            ivec2 cell = start_cell;
+            ivec2 step = ivec2(d.x > 0 ? 1 : -1, d.y > 0 ? 1 : -1);
+            float t = 0, t_prev = 0; // 当前像素（块）的入口参数与上一段的入口参数
+
+            while (in_bound(cell)) {
+                int size = 1;
+                if (occupancy.empty_block(2, cell)) {
+                    size = OccupancyMap::block_size(2);
+                }
+                else if (occupancy.empty_block(1, cell)) {
+                    size = OccupancyMap::block_size(1);
+                }
+                else if (cell != start_cell && occupancy.test(cell)) {
+                    float t_stop = std::max((t_prev + t) * 0.5f, t - 0.5f / length(d));
+                    vec2 stop = start + d * t_stop;
+                    ivec2 stop_cell = f2i(stop);
+                    bool free = stop_cell != start_cell && in_bound(stop_cell) && !occupancy.test(stop_cell);
+                    result.pos = free ? stop : start;
+                    int im = idx(cell);
+                    if (solid.test(im)) {
+                        result.solid = true;
+                    }
+                    else {
+                        PixelParticleList lst = state_cur.map_index[im];
+                        result.target_index = hash_sample(seed, lst.from, lst.to);
+                    }
+                    return true;
+                }
 
-            float len = length(start - end);
-            if (len == 0.0f) goto exit;
+                // 离开当前像素（块）的位置，沿先到达的边界前进到相邻的像素
+                ivec2 lo = cell & ivec2(~(size - 1));
+                float tx = d.x != 0 ? ((step.x > 0 ? lo.x + size : lo.x) - o.x) / d.x : INFINITY;
+                float ty = d.y != 0 ? ((step.y > 0 ? lo.y + size : lo.y) - o.y) / d.y : INFINITY;
+                float t_exit = std::min(tx, ty);
+                if (t_exit >= 1) break;
+
+                ivec2 next = ivec2(floor(o + d * t_exit));
+                next.x = tx <= ty ? (step.x > 0 ? lo.x + size : lo.x - 1) : clamp(next.x, lo.x, lo.x + size - 1);
+                next.y = ty <= tx ? (step.y > 0 ? lo.y + size : lo.y - 1) : clamp(next.y, lo.y, lo.y + size - 1);
+                t_prev = t;
+                t = t_exit;
+                cell = next;
+            }
+            return false;
+        }
 
-            int steps = length(end - start) / K_COLLISION_STEP_LENGTH;
+        struct PositionBuffer {
+            vector<vec2> vel; // 碰撞前的速度快照
+            vector<int> target; // 碰撞到的粒子，-1 表示没有碰撞其他粒子
+            vector<vec2> own_vel, target_vel; // 碰撞后自身与被碰撞粒子的速度
+            vector<int> writer; // 最后一个写入该粒子速度的粒子
+            vector<vector<int>> chunk_hits; // 各分块内碰撞了其他粒子的粒子，下标递增
+        } position_buf;
+
+        // 更新位置，碰撞检测
+        // 各粒子只读取 state_cur 与速度快照，因此可以分块并行计算；唯一的冲突是碰撞时写入被碰撞粒子的速度。
+        // 串行执行时后写入的结果生效，即每个粒子的速度取自下标最大的写入者（自身或碰撞它的粒子），
+        // 按此规则合并，结果与串行执行完全相同
+        void compute_position() {
+            PositionBuffer& pb = position_buf;
+            int n = state_cur.particles;
+            int n_chunks = (n + K_POSITION_GRAIN - 1) / K_POSITION_GRAIN;
+            pb.vel.assign(state_next.p_vel.begin(), state_next.p_vel.begin() + n);
+            pb.target.resize(n);
+            pb.own_vel.resize(n);
+            pb.target_vel.resize(n);
+            pb.writer.assign(n, -1);
+            pb.chunk_hits.resize(n_chunks);
+
+            // 1. 各粒子求新位置与碰撞结果，只写本粒子的数据
+            parallel_line.parallel_for(0, n, K_POSITION_GRAIN, [this, &pb](int from, int to) {
+                vector<int>& hits = pb.chunk_hits[from / K_POSITION_GRAIN];
+                hits.clear();
+                for (int ip = from; ip < to; ip++) {
+                    ParticleType cur_type = state_cur.p_type[ip];
+                    if (sleeping(ip)) continue;
+
+                    vec2 v = pb.vel[ip];
+                    vec2 pos_old = state_cur.p_pos[ip];
+                    vec2 pos_new = pos_old + v * K_DT;
+                    CollisionDetectionResult c_res;
+
+                    bool collided = detect_collision(pos_old, pos_new, false, hash_combine(frame_counter, ip), c_res);
+                    if (collided && c_res.solid) {
+                        // 固体质量视为无穷大且静止
+                        pb.own_vel[ip] = -K_COLLISION_RESTITUTION * pb.vel[ip];
+                        pb.writer[ip] = ip;
+                    }
+                    else if (collided) {
+                        ParticleType target_type = state_cur.p_type[c_res.target_index];
+                        float v1x0, v1y0, v2x0, v2y0;
+                        float v1x1, v1y1, v2x1, v2y1;
+
+                        float m1, m2;
+                        m1 = particle_mass(cur_type);
+                        m2 = particle_mass(target_type);
+
+                        //v1: active one
+                        //v2: passive one
+                        v1x0 = pb.vel[ip].x;
+                        v2x0 = pb.vel[c_res.target_index].x;
+
+                        v1y0 = pb.vel[ip].y;
+                        v2y0 = pb.vel[c_res.target_index].y;
+
+                        v1x1 = 1.0f * (m1 * v1x0 + m2 * v2x0 + K_COLLISION_RESTITUTION * m2 * (v2x0 - v1x0)) / (m1 + m2);
+                        v1y1 = 1.0f * (m1 * v1y0 + m2 * v2y0 + K_COLLISION_RESTITUTION * m2 * (v2y0 - v1y0)) / (m1 + m2);
+
+                        v2x1 = 1.0f * (m1 * v1x0 + m2 * v2x0 + K_COLLISION_RESTITUTION * m1 * (v1x0 - v2x0)) / (m1 + m2);
+                        v2y1 = 1.0f * (m1 * v1y0 + m2 * v2y0 + K_COLLISION_RESTITUTION * m1 * (v1y0 - v2y0)) / (m1 + m2);
+
+                        pb.own_vel[ip] = vec2(v1x1, v1y1);
+                        pb.writer[ip] = ip;
+                        pb.target[ip] = c_res.target_index;
+                        pb.target_vel[ip] = vec2(v2x1, v2y1);
+                        hits.push_back(ip);
+                    }
+                    state_next.p_pos[ip] = c_res.pos;
+                    state_next.p_movement[ip] = state_next.p_pos[ip] - state_cur.p_pos[ip];
 
-            vec2 delta = normalize(end - start) * K_COLLISION_STEP_LENGTH;
-            vec2 cur = start;//排除所在的第一个位置，从第二个开始
+                    ivec2 coord = f2i(c_res.pos);
+                    if (!in_bound(coord)) {
+                        state_next.p_type[ip] = ParticleType::None;
+                    }
+                }
+            });
 
-            if (steps < 1) {
-                steps = 1;
+            // 2. 按分块顺序登记对其他粒子的写入，只涉及发生碰撞的粒子
+            for (auto& hits : pb.chunk_hits) {
+                for (int ip : hits) {
+                    int& w = pb.writer[pb.target[ip]];
+                    w = std::max(w, ip);
+                }
             }
 
-            delta = (end - start) / float(steps);
-
-            for (int i = 0; i < steps; i++) {
-                cur += delta;
-
-                ivec2 m_pos = f2i(cur);
-                bool ext = false;
+            // 3. 写回速度
+            parallel_line.parallel_for(0, n, K_POSITION_GRAIN, [this, &pb](int from, int to) {
+                for (int ip = from; ip < to; ip++) {
+                    int w = pb.writer[ip];
+                    if (w == ip) state_next.p_vel[ip] = pb.own_vel[ip];
+                    else if (w >= 0) state_next.p_vel[ip] = pb.target_vel[w];
+                }
+            });
+        }
+#pragma endregion
 
-                if (in_bound(m_pos)) {
-                    PixelParticleList lst = state_cur.map_index[idx(m_pos)];
-                    if (!lst.nil() && idx(f2i(cur)) != idx(f2i(cur - delta)) && f2i(cur) != f2i(start)) {
-                        ext = true;
-                        final_pos = cur - delta;
-                        last_target = random_sample(lst.from, lst.to);
+#pragma region 休眠
+
+        // 需要唤醒的像素，每帧由运动的粒子和画笔标记，update_sleep() 使用后清除
+        vector<unsigned char> wake_mask;
+        vector<int> wake_pixels;
+        vector<vector<int>> chunk_moving;
+
+        void mark_wake(ivec2 center) {
+            for (int dy = -K_WAKE_RADIUS; dy <= K_WAKE_RADIUS; dy++) {
+                for (int dx = -K_WAKE_RADIUS; dx <= K_WAKE_RADIUS; dx++) {
+                    ivec2 p = center + ivec2(dx, dy);
+                    if (!in_bound(p)) continue;
+                    int im = idx(p);
+                    if (!wake_mask[im]) {
+                        wake_mask[im] = 1;
+                        wake_pixels.push_back(im);
                     }
                 }
-                else {
-                    final_pos = cur;
-                    ext = true;
-                }
-                if (ext) {
-                    goto exit;
-                }
             }
-        exit:
-            result.pos = final_pos;
-            result.target_index = last_target;
-            return last_target != -1;
         }
 
-        vector<vec2> vel_buf;
-        void compute_position() {
-            vel_buf.resize(state_cur.particles);
-            for (int ip = 0; ip < state_cur.particles; ip++) {
-                vel_buf[ip] = state_next.p_vel[ip];
+        // 更新 state_next 中各粒子的休眠计数
+        // 位移和速度都低于阈值的帧累计计数，达到 K_SLEEP_FRAMES 后粒子休眠并清零速度；
+        // 休眠粒子被较强地碰撞、附近有粒子运动或画笔、所在处气流速度过大时被唤醒
+        void update_sleep() {
+            int n = state_next.particles;
+            int n_chunks = (n + K_SORT_GRAIN - 1) / K_SORT_GRAIN;
+            chunk_moving.resize(n_chunks);
+            parallel_line.parallel_for(0, n, K_SORT_GRAIN, [this](int from, int to) {
+                vector<int>& moving = chunk_moving[from / K_SORT_GRAIN];
+                moving.clear();
+                for (int ip = from; ip < to; ip++) {
+                    if (length(state_next.p_movement[ip]) > K_SLEEP_MOVEMENT) moving.push_back(ip);
+                }
+            });
+            for (auto& moving : chunk_moving) {
+                for (int ip : moving) {
+                    mark_wake(f2i(state_next.p_pos[ip]));
+                    mark_wake(f2i(state_next.p_pos[ip] - state_next.p_movement[ip]));
+                }
             }
 
-            // 更新位置，碰撞检测
-            for (int ip = 0; ip < state_cur.particles; ip++) {
-                ParticleType cur_type = state_cur.p_type[ip];
-                if (cur_type == ParticleType::Iron) continue;
-
-                vec2 v = vel_buf[ip];
-                vec2 pos_old = state_cur.p_pos[ip];
-                vec2 pos_new = pos_old + v * K_DT;
-                CollisionDetectionResult c_res;
-
+            parallel_line.parallel_for(0, n, K_SORT_GRAIN, [this](int from, int to) {
+                for (int ip = from; ip < to; ip++) {
+                    int& sleep = state_next.p_sleep[ip];
+                    vec2 vel = state_next.p_vel[ip];
+                    ivec2 pos = f2i(state_next.p_pos[ip]);
+                    bool disturbed = in_bound(pos) && wake_mask[idx(pos)];
+                    if (sleep >= K_SLEEP_FRAMES) {
+                        bool hit = length(vel) > K_SLEEP_VELOCITY;
+                        bool windy = length(bilinear_sample_air_v(pos)) > K_WAKE_AIR_VELOCITY;
+                        if (hit || disturbed || windy) sleep = 0;
+                    }
+                    else if (!disturbed && length(state_next.p_movement[ip]) <= K_SLEEP_MOVEMENT && length(vel) <= K_SLEEP_VELOCITY) {
+                        sleep++;
+                        if (sleep >= K_SLEEP_FRAMES) state_next.p_vel[ip] = vec2();
+                    }
+                    else {
+                        sleep = 0;
+                    }
+                }
+            });
 
-                bool collided = detect_collision(pos_old, pos_new, false, c_res);
-                if (collided) {
-                    ParticleType target_type = state_cur.p_type[c_res.target_index];
-                    float v1x0, v1y0, v2x0, v2y0;
-                    float v1x1, v1y1, v2x1, v2y1;
+            for (int im : wake_pixels) {
+                wake_mask[im] = 0;
+            }
+            wake_pixels.clear();
+        }
 
-                    float m1, m2;
-                    m1 = particle_mass(cur_type);
-                    m2 = particle_mass(target_type);
+#pragma endregion
 
-                    //v1: active one
-                    //v2: passive one
-                    v1x0 = vel_buf[ip].x;
-                    v2x0 = vel_buf[c_res.target_index].x;
+#pragma region 完成帧
+        struct ReorderBuffer {
+            vector<int> p_idx; // 排序后各位置粒子对应的画布下标
+            vector<int> sort; // 排序后各位置粒子在 state_next 中的下标
+            vector<int> p_idx_tmp, sort_tmp; // 基数排序的另一组缓冲
+            vector<int> bucket_offset; // 每个分块各个桶的写入位置 [chunk * buckets + bucket]
+            vector<int> chunk_offset;
+
+            // 增量重排使用
+            vector<int> key_next; // state_next 中各粒子的画布下标，已消失的粒子为 -1
+            vector<vector<int>> chunk_moved; // 各分块中像素发生变化的粒子
+            vector<int> moved; // 全部像素发生变化的粒子（state_next 下标）
+            StateNext tail; // state_next 中需要重新排列的尾部数据
+        } reorder_buf;
 
-                    v1y0 = vel_buf[ip].y;
-                    v2y0 = vel_buf[c_res.target_index].y;
+        static constexpr int key_bits() {
+            int bits = 1;
+            while ((1 << bits) < width * height) bits++;
+            return bits;
+        }
 
-                    v1x1 = 1.0f * (m1 * v1x0 + m2 * v2x0 + K_COLLISION_RESTITUTION * m2 * (v2x0 - v1x0)) / (m1 + m2);
-                    v1y1 = 1.0f * (m1 * v1y0 + m2 * v2y0 + K_COLLISION_RESTITUTION * m2 * (v2y0 - v1y0)) / (m1 + m2);
+        // 按画布下标对 state_next 中仍存在的粒子做稳定的并行 LSD 基数排序
+        // 每一趟：各分块统计桶计数，按 (桶, 分块) 顺序求前缀和，再由各分块按原顺序散射
+        void sort_by_pixel() {
+            ReorderBuffer& rb = reorder_buf;
+            int n = state_next.particles;
+            int n_chunks = (n + K_SORT_GRAIN - 1) / K_SORT_GRAIN;
+            rb.p_idx.resize(n);
+            rb.sort.resize(n);
+            rb.p_idx_tmp.resize(n);
+            rb.sort_tmp.resize(n);
+            rb.chunk_offset.assign(n_chunks + 1, 0);
+
+            // 1. 计算画布下标，剔除已离开画布的粒子
+            parallel_line.parallel_for(0, n, K_SORT_GRAIN, [this, &rb](int from, int to) {
+                int cnt = 0;
+                for (int ip = from; ip < to; ip++) {
+                    ivec2 pos = f2i(state_next.p_pos[ip]);
+                    bool alive = state_next.p_type[ip] != ParticleType::None && in_bound(pos);
+                    rb.p_idx_tmp[ip] = alive ? idx(pos) : -1;
+                    cnt += alive;
+                }
+                rb.chunk_offset[from / K_SORT_GRAIN + 1] = cnt;
+            });
+            for (int c = 0; c < n_chunks; c++) {
+                rb.chunk_offset[c + 1] += rb.chunk_offset[c];
+            }
+            int n_alive = rb.chunk_offset[n_chunks];
+            parallel_line.parallel_for(0, n, K_SORT_GRAIN, [&rb](int from, int to) {
+                int pos = rb.chunk_offset[from / K_SORT_GRAIN];
+                for (int ip = from; ip < to; ip++) {
+                    if (rb.p_idx_tmp[ip] < 0) continue;
+                    rb.p_idx[pos] = rb.p_idx_tmp[ip];
+                    rb.sort[pos] = ip;
+                    pos++;
+                }
+            });
+            rb.p_idx.resize(n_alive);
+            rb.sort.resize(n_alive);
+
+            // 2. 按位分趟排序
+            constexpr int passes = (key_bits() + 10) / 11;
+            constexpr int digit_bits = (key_bits() + passes - 1) / passes;
+            constexpr int buckets = 1 << digit_bits;
+            n_chunks = (n_alive + K_SORT_GRAIN - 1) / K_SORT_GRAIN;
+            rb.bucket_offset.resize(n_chunks * buckets);
+            for (int pass = 0; pass < passes; pass++) {
+                int shift = pass * digit_bits;
+                parallel_line.parallel_for(0, n_alive, K_SORT_GRAIN, [&rb, shift](int from, int to) {
+                    int* cnt = &rb.bucket_offset[from / K_SORT_GRAIN * buckets];
+                    fill(cnt, cnt + buckets, 0);
+                    for (int i = from; i < to; i++) {
+                        cnt[(rb.p_idx[i] >> shift) & (buckets - 1)]++;
+                    }
+                });
+                int sum = 0;
+                for (int b = 0; b < buckets; b++) {
+                    for (int c = 0; c < n_chunks; c++) {
+                        int cnt = rb.bucket_offset[c * buckets + b];
+                        rb.bucket_offset[c * buckets + b] = sum;
+                        sum += cnt;
+                    }
+                }
+                parallel_line.parallel_for(0, n_alive, K_SORT_GRAIN, [&rb, shift](int from, int to) {
+                    int* offset = &rb.bucket_offset[from / K_SORT_GRAIN * buckets];
+                    for (int i = from; i < to; i++) {
+                        int pos = offset[(rb.p_idx[i] >> shift) & (buckets - 1)]++;
+                        rb.p_idx_tmp[pos] = rb.p_idx[i];
+                        rb.sort_tmp[pos] = rb.sort[i];
+                    }
+                });
+                rb.p_idx.swap(rb.p_idx_tmp);
+                rb.sort.swap(rb.sort_tmp);
+                rb.p_idx_tmp.resize(n_alive);
+                rb.sort_tmp.resize(n_alive);
+            }
+        }
 
-                    v2x1 = 1.0f * (m1 * v1x0 + m2 * v2x0 + K_COLLISION_RESTITUTION * m1 * (v1x0 - v2x0)) / (m1 + m2);
-                    v2y1 = 1.0f * (m1 * v1y0 + m2 * v2y0 + K_COLLISION_RESTITUTION * m1 * (v1y0 - v2y0)) / (m1 + m2);
+        void swap_state() {
+            state_cur.p_pos.swap(state_next.p_pos);
+            state_cur.p_type.swap(state_next.p_type);
+            state_cur.p_vel.swap(state_next.p_vel);
+            state_cur.p_movement.swap(state_next.p_movement);
+            state_cur.p_heat.swap(state_next.p_heat);
+            state_cur.p_sleep.swap(state_next.p_sleep);
+        }
 
-                    state_next.p_vel[ip] = vec2(v1x1, v1y1);
-                    state_next.p_vel[c_res.target_index] = vec2(v2x1, v2y1);
+        // 按 reorder_buf.p_idx 重建 [from, to) 范围内的画布索引，from 必须是某个像素区间的起点
+        void rebuild_map_index(int from, int to) {
+            int n_new = to;
+            parallel_line.parallel_for(from, to, K_SORT_GRAIN, [this, from, n_new](int f, int t) {
+                const vector<int>& p_idx = reorder_buf.p_idx;
+                for (int ip = f; ip < t; ip++) {
+                    int im = p_idx[ip];
+                    if (ip == from || p_idx[ip - 1] != im) state_cur.map_index[im].from = ip;
+                    if (ip == n_new - 1 || p_idx[ip + 1] != im) state_cur.map_index[im].to = ip;
                 }
-                state_next.p_pos[ip] = c_res.pos;
-                state_next.p_movement[ip] = state_next.p_pos[ip] - state_cur.p_pos[ip];
+            });
+        }
 
-                ivec2 coord = f2i(c_res.pos);
-                if (!in_bound(coord)) {
-                    state_next.p_type[ip] = ParticleType::None;
-                }
+        void build_occupancy() {
+            occupancy.clear();
+            for (int ip = 0; ip < state_cur.particles; ip++) {
+                occupancy.set(f2i(state_cur.p_pos[ip]));
             }
+            for (int im : solid.cells) {
+                occupancy.set(ivec2(im % width, im / width));
+            }
+            occupancy.build_summary();
         }
-#pragma endregion
 
-#pragma region 完成帧
-        struct ReorderBuffer {
-            vector<int> p_idx; // 记录各个粒子对应的画布下标
-            vector<int> sort; // 初始时为0..particles-1，根据画布下标排序
-        } reorder_buf;
+        // 完整重排：对全部粒子排序并重建画布索引
+        void complete_full() {
+            sort_by_pixel();
 
+            int n_new = reorder_buf.sort.size();
+            // 使用刚才的StateNext，生成下一个StateCur
+            // 复制数据的同时构造画布索引：排序后同一像素的粒子相邻，区间端点各由一个粒子写入，可以并行
+            state_cur.reset(n_new);
+            parallel_line.parallel_for(0, n_new, K_SORT_GRAIN, [this](int from, int to) {
+                for (int ip = from; ip < to; ip++) {
+                    int old_ip = reorder_buf.sort[ip];
+                    state_cur.p_pos[ip] = state_next.p_pos[old_ip];
+                    state_cur.p_type[ip] = state_next.p_type[old_ip];
+                    state_cur.p_vel[ip] = state_next.p_vel[old_ip];
+                    state_cur.p_movement[ip] = state_next.p_movement[old_ip];
+                    state_cur.p_heat[ip] = state_next.p_heat[old_ip];
+                    state_cur.p_sleep[ip] = state_next.p_sleep[old_ip];
+                }
+            });
+            rebuild_map_index(0, n_new);
+            build_occupancy();
+        }
 
-        // 完成StateNext的所有计算，将结果收集到StateCur中
-        void complete() {
-            reorder_buf.p_idx.clear();
-            reorder_buf.sort.clear();
-            for (int ip = 0; ip < state_next.particles; ip++) {
-                ivec2 pos = f2i(state_next.p_pos[ip]);
-                reorder_buf.p_idx.push_back(idx(pos));
-                if (state_next.p_type[ip] != ParticleType::None) {
-                    reorder_buf.sort.push_back(ip);
+        // 增量重排
+        // state_next 的前 state_cur.particles 个粒子与 state_cur 顺序相同，本来就按画布下标有序。
+        // 只需找出像素发生变化的粒子（包括新粒子和消失的粒子），把它们移出/插入有序序列，
+        // 第一个变化位置之前的数据与画布索引保持不变。
+        // 变化的粒子超过 K_RESORT_FULL_RATIO 时返回 false，改用完整重排。
+        bool complete_incremental() {
+            ReorderBuffer& rb = reorder_buf;
+            int n = state_next.particles;
+            int n_old = state_cur.particles;
+            if (n == 0) return false;
+
+            // 1. 找出像素发生变化的粒子
+            int n_chunks = (n + K_SORT_GRAIN - 1) / K_SORT_GRAIN;
+            rb.key_next.resize(n);
+            rb.chunk_moved.resize(n_chunks);
+            int n_moved = parallel_line.parallel_reduce(0, n, K_SORT_GRAIN, 0, [this, &rb, n_old](int from, int to) {
+                vector<int>& moved = rb.chunk_moved[from / K_SORT_GRAIN];
+                moved.clear();
+                for (int ip = from; ip < to; ip++) {
+                    ivec2 pos = f2i(state_next.p_pos[ip]);
+                    bool alive = state_next.p_type[ip] != ParticleType::None && in_bound(pos);
+                    int key = alive ? idx(pos) : -1;
+                    rb.key_next[ip] = key;
+                    if (ip >= n_old || key != idx(f2i(state_cur.p_pos[ip]))) {
+                        moved.push_back(ip);
+                    }
                 }
+                return int(moved.size());
+            }, [](int a, int b) { return a + b; });
+
+            if (n_moved > n * K_RESORT_FULL_RATIO) return false;
+
+            // 没有粒子改变像素：顺序不变，直接交换数据
+            if (n_moved == 0) {
+                swap_state();
+                state_cur.resize(n);
+                build_occupancy();
+                return true;
             }
 
-            vector<int>& p_idx = reorder_buf.p_idx;
-            sort(reorder_buf.sort.begin(), reorder_buf.sort.end(), [&p_idx](int i1, int i2) { return p_idx[i1] < p_idx[i2]; });
+            rb.moved.clear();
+            for (auto& moved : rb.chunk_moved) {
+                rb.moved.insert(rb.moved.end(), moved.begin(), moved.end());
+            }
 
-            int n_new = reorder_buf.sort.size();
-            // 使用刚才的StateNext，生成下一个StateCur
+            // 2. 清除移出像素的旧索引，剩余粒子所在区间随后重建
+            int first_change = n_old;
+            for (int ip : rb.moved) {
+                if (ip >= n_old) break;
+                first_change = std::min(first_change, ip);
+                state_cur.map_index[idx(f2i(state_cur.p_pos[ip]))] = PixelParticleList();
+            }
 
-            state_cur.reset(n_new);
-            for (int ip = 0; ip < n_new; ip++) {
-                int old_ip = reorder_buf.sort[ip];
-                // 复制数据
-                vec2 pos = state_next.p_pos[old_ip];
-                state_cur.p_pos[ip] = pos;
-                state_cur.p_type[ip] = state_next.p_type[old_ip];
-                state_cur.p_vel[ip] = state_next.p_vel[old_ip];
-                state_cur.p_movement[ip] = state_next.p_movement[old_ip];
-                state_cur.p_heat[ip] = state_next.p_heat[old_ip];
-                // 构造画布索引
-                PixelParticleList& cur_lst = state_cur.map_index[idx(f2i(pos))];
-                cur_lst.append(ip);
+            // 3. 仍存在的变化粒子按画布下标稳定排序，再与未变化的粒子归并
+            auto new_end = remove_if(rb.moved.begin(), rb.moved.end(), [&rb](int ip) { return rb.key_next[ip] < 0; });
+            rb.moved.erase(new_end, rb.moved.end());
+            stable_sort(rb.moved.begin(), rb.moved.end(), [&rb](int a, int b) { return rb.key_next[a] < rb.key_next[b]; });
+
+            // 第一个变化的位置：第一个移出的粒子，或第一个插入点（相同像素时未变化的粒子在前）
+            int d = first_change;
+            if (!rb.moved.empty()) {
+                int first_key = rb.key_next[rb.moved[0]];
+                auto it = upper_bound(rb.key_next.begin(), rb.key_next.begin() + d, first_key);
+                d = int(it - rb.key_next.begin());
+            }
 
-                if (state_cur.p_type[ip] == ParticleType::Water) {
-                    BlockLiquidList& cur_liquid_lst = state_cur.map_block_liquid[idx_liquid(f2i(pos))];
-                    cur_liquid_lst.idx_lp.push_back(ip);
+            int n_new = n_old - (n_moved - (n - n_old)) + int(rb.moved.size());
+            rb.sort.resize(n_new);
+            rb.p_idx.resize(n_new);
+            int ip_new = d, im = 0;
+            for (int ip = d; ip < n_old; ip++) {
+                int key = rb.key_next[ip];
+                if (key != idx(f2i(state_cur.p_pos[ip]))) continue;
+                while (im < int(rb.moved.size()) && rb.key_next[rb.moved[im]] < key) {
+                    rb.sort[ip_new] = rb.moved[im];
+                    rb.p_idx[ip_new++] = rb.key_next[rb.moved[im++]];
+                }
+                rb.sort[ip_new] = ip;
+                rb.p_idx[ip_new++] = key;
+            }
+            while (im < int(rb.moved.size())) {
+                rb.sort[ip_new] = rb.moved[im];
+                rb.p_idx[ip_new++] = rb.key_next[rb.moved[im++]];
+            }
+            assert(ip_new == n_new);
+
+            // 4. 交换数据，[0, d) 已在正确位置；[d, n_new) 从暂存的尾部数据中收集
+            swap_state();
+
+            StateNext& tail = rb.tail;
+            tail.p_pos.assign(state_cur.p_pos.begin() + d, state_cur.p_pos.begin() + n);
+            tail.p_type.assign(state_cur.p_type.begin() + d, state_cur.p_type.begin() + n);
+            tail.p_vel.assign(state_cur.p_vel.begin() + d, state_cur.p_vel.begin() + n);
+            tail.p_movement.assign(state_cur.p_movement.begin() + d, state_cur.p_movement.begin() + n);
+            tail.p_heat.assign(state_cur.p_heat.begin() + d, state_cur.p_heat.begin() + n);
+            tail.p_sleep.assign(state_cur.p_sleep.begin() + d, state_cur.p_sleep.begin() + n);
+            state_cur.resize(n_new);
+            parallel_line.parallel_for(d, n_new, K_SORT_GRAIN, [this, &tail, d](int from, int to) {
+                for (int ip = from; ip < to; ip++) {
+                    int src = reorder_buf.sort[ip] - d;
+                    state_cur.p_pos[ip] = tail.p_pos[src];
+                    state_cur.p_type[ip] = tail.p_type[src];
+                    state_cur.p_vel[ip] = tail.p_vel[src];
+                    state_cur.p_movement[ip] = tail.p_movement[src];
+                    state_cur.p_heat[ip] = tail.p_heat[src];
+                    state_cur.p_sleep[ip] = tail.p_sleep[src];
+                }
+            });
+
+            // 5. 从 d 前一个粒子所在像素的起点开始重建画布索引
+            int s = d;
+            if (s > 0) {
+                int key = rb.key_next[s - 1];
+                while (s > 0 && rb.key_next[s - 1] == key) {
+                    s--;
+                    rb.p_idx[s] = key;
                 }
             }
+            rebuild_map_index(s, n_new);
+            build_occupancy();
+            return true;
+        }
 
+        // 完成StateNext的所有计算，将结果收集到StateCur中
+        void complete() {
+            merge_brush_results();
+            update_sleep();
+            if (!complete_incremental()) {
+                complete_full();
+            }
         }
 #pragma endregion
 
 #pragma region 交互
 
+        // 画笔的结果先写入独立的缓冲，由 complete() 合并到 state_next
+        // 这样画笔处理不会与写 state_next 的各阶段冲突，可以和它们同时进行
+        struct BrushBuffer {
+            vector<float> heat_delta; // 按 state_cur 下标的温度增量
+            vector<int> solid_heat_cells; // 被加热的固体像素及其增量
+            vector<float> solid_heat_delta;
+            vector<vec2> new_pos;
+            vector<ParticleType> new_type;
+        } brush_buf;
+
+        void merge_brush_results() {
+            for (int ip = 0; ip < int(brush_buf.heat_delta.size()); ip++) {
+                state_next.p_heat[ip] += brush_buf.heat_delta[ip];
+            }
+            brush_buf.heat_delta.clear();
+            for (int i = 0; i < int(brush_buf.solid_heat_cells.size()); i++) {
+                solid.heat[brush_buf.solid_heat_cells[i]] += brush_buf.solid_heat_delta[i];
+            }
+            brush_buf.solid_heat_cells.clear();
+            brush_buf.solid_heat_delta.clear();
+
+            // 扩大数组，将新粒子追加到state_next尾部；铁加入固体层
+            for (int i = 0; i < int(brush_buf.new_pos.size()); i++) {
+                if (brush_buf.new_type[i] == ParticleType::Iron) {
+                    add_solid(f2i(brush_buf.new_pos[i]), 25);
+                    mark_wake(f2i(brush_buf.new_pos[i]));
+                    continue;
+                }
+                if (brush_buf.new_type[i] == ParticleType::Water) {
+                    liquid_acc_known = false;
+                }
+                state_next.particles++;
+                state_next.p_pos.push_back(brush_buf.new_pos[i]);
+                state_next.p_type.push_back(brush_buf.new_type[i]);
+                state_next.p_vel.push_back(vec2());
+                state_next.p_movement.push_back(vec2());
+                state_next.p_heat.push_back(25);
+                state_next.p_sleep.push_back(0);
+                mark_wake(f2i(brush_buf.new_pos[i]));
+            }
+            brush_buf.new_pos.clear();
+            brush_buf.new_type.clear();
+        }
+
         ParticleBrush cur_particle_brush;
         void handle_new_particles() {
-            // 扩大数组，将新粒子追加到state_next尾部
             if (cur_particle_brush.type != ParticleType::None) {
                 ivec2 center = f2i(cur_particle_brush.center);
                 int r_find = cur_particle_brush.radius + 1;
                 for (int x = center.x - r_find; x <= center.x + r_find; x++) {
                     for (int y = center.y - r_find; y <= center.y + r_find; y++) {
                         if (in_bound(x, y) && glm::distance(vec2(x, y), cur_particle_brush.center) <= cur_particle_brush.radius) {
-                            if (state_cur.map_index[idx(ivec2(x, y))].nil()) {
-                                state_next.particles++;
-                                vec2 jitter = vec2(random(-1, 1), random(-1, 1)) * 0.2f;
-                                state_next.p_pos.push_back(vec2(x, y) + jitter);
-                                state_next.p_type.push_back(cur_particle_brush.type);
-                                state_next.p_vel.push_back(vec2());
-                                state_next.p_movement.push_back(vec2());
-                                state_next.p_heat.push_back(25);
+                            if (state_cur.map_index[idx(ivec2(x, y))].nil() && !solid.test(idx(x, y))) {
+                                unsigned int seed = hash_combine(frame_counter, idx(x, y));
+                                vec2 jitter = vec2(hash_random(seed, -1, 1), hash_random(seed + 1, -1, 1)) * 0.2f;
+                                brush_buf.new_pos.push_back(vec2(x, y) + jitter);
+                                brush_buf.new_type.push_back(cur_particle_brush.type);
                             }
                         }
                     }
@@ -641,17 +1546,23 @@ namespace Simflow {
         HeatBrush cur_heat_brush;
         void handle_change_heat() {
             if (has_heat_brush) {
+                brush_buf.heat_delta.assign(state_cur.particles, 0.0f);
                 ivec2 center = f2i(cur_heat_brush.center);
                 int r_find = cur_heat_brush.radius + 1;
                 for (int y = center.y - r_find; y <= center.y + r_find; y++) {
                     for (int x = center.x - r_find; x <= center.x + r_find; x++) {
                         if (in_bound(x, y) && glm::distance(vec2(x, y), cur_heat_brush.center) <= cur_heat_brush.radius) {
+                            float delta = (cur_heat_brush.increase ? 1 : -1) * K_HEAT_DELTA;
                             PixelParticleList lst = state_cur.map_index[idx(ivec2(x, y))];
                             if (!lst.nil()) {
                                 for (int ip = lst.from; ip <= lst.to; ip++) {
-                                    state_next.p_heat[ip] += (cur_heat_brush.increase ? 1 : -1) * K_HEAT_DELTA;
+                                    brush_buf.heat_delta[ip] += delta;
                                 }
                             }
+                            if (solid.test(idx(x, y))) {
+                                brush_buf.solid_heat_cells.push_back(idx(x, y));
+                                brush_buf.solid_heat_delta.push_back(delta);
+                            }
                         }
                     }
                 }
@@ -659,6 +1570,182 @@ namespace Simflow {
             }
         }
 
+#pragma endregion
+
+#pragma region 帧任务图
+
+        // 各阶段读写的数据，用于推导阶段之间的依赖关系
+        enum FrameField : unsigned int {
+            F_CUR_POS = 1 << 0,
+            F_CUR_VEL = 1 << 1,
+            F_CUR_TYPE = 1 << 2,
+            F_CUR_HEAT = 1 << 3,
+            F_CUR_MOVEMENT = 1 << 4,
+            F_MAP_INDEX = 1 << 5, // state_cur.map_index 与 occupancy
+            F_NEXT_POS = 1 << 6,
+            F_NEXT_VEL = 1 << 7,
+            F_NEXT_TYPE = 1 << 8,
+            F_NEXT_HEAT = 1 << 9,
+            F_NEXT_MOVEMENT = 1 << 10,
+            F_AIR_SOLVER = 1 << 11, // airflow_solver 内部的网格
+            F_AIR_SNAPSHOT = 1 << 12, // air_vel_buf 与 air_p_buf
+            F_HEAT_BRUSH = 1 << 13, // brush_buf.heat_delta
+            F_PARTICLE_BRUSH = 1 << 14, // brush_buf.new_*
+            F_CUR_SLEEP = 1 << 15,
+            F_NEXT_SLEEP = 1 << 16,
+            F_SOLID = 1 << 17, // solid 的占用位图与像素列表
+            F_SOLID_HEAT = 1 << 18, // solid.heat
+            F_CUR_ALL = F_CUR_POS | F_CUR_VEL | F_CUR_TYPE | F_CUR_HEAT | F_CUR_MOVEMENT | F_CUR_SLEEP | F_MAP_INDEX,
+            F_NEXT_ALL = F_NEXT_POS | F_NEXT_VEL | F_NEXT_TYPE | F_NEXT_HEAT | F_NEXT_MOVEMENT | F_NEXT_SLEEP,
+        };
+
+        struct FrameStage {
+            const char* name;
+            unsigned int reads, writes;
+            function<void()> work;
+            float ms = 0; // 最近一帧的耗时
+        };
+
+        vector<FrameStage> stages;
+        Parallel::TaskGraph frame_graph;
+
+    public:
+        // 各子系统每隔几帧计算一次，一次推进 周期 × K_DT；其余帧沿用上次的结果（气流快照、粒子与固体温度）
+        // 液体与粒子速度每帧计算：位置每帧都要积分，不能沿用
+        int air_period = K_AIR_PERIOD;
+        int heat_period = K_HEAT_PERIOD;
+
+        // 由质量调节器在 [下限, 默认值] 内调整，见 govern_quality
+        int liquid_iterations = K_LIQUID_ITERATIONS; // 每帧液体子步数的上限，不超过 K_LIQUID_ITERATIONS（随机种子依赖这一点）
+        int liquid_substeps = 0; // 最近一帧的液体子步数，见 liquid_substep_count
+        int heat_slowdown = 1; // 温度计算每步只运行所需迭代的 1 / heat_slowdown，步长不变：保持稳定，但热传导变慢
+
+    private:
+        // 本帧是否轮到周期为 period 的子系统；phase 错开各子系统，周期都为偶数时气流与温度不在同一帧计算
+        bool stage_due(int period, int phase) {
+            return period <= 1 || (frame_counter + phase) % period == 0;
+        }
+
+        // 按顺序声明阶段，声明顺序即串行执行时的语义顺序
+        void add_stage(const char* name, unsigned int reads, unsigned int writes, function<void()> work) {
+            stages.push_back(FrameStage{ name, reads, writes, move(work) });
+        }
+
+        // 若前面的阶段与当前阶段存在写后读、读后写或写后写的冲突，则当前阶段依赖它
+        void build_frame_graph() {
+            frame_graph.clear();
+            for (int i = 0; i < int(stages.size()); i++) {
+                vector<int> deps;
+                for (int j = 0; j < i; j++) {
+                    bool conflict = (stages[j].writes & (stages[i].reads | stages[i].writes)) || (stages[j].reads & stages[i].writes);
+                    if (conflict) deps.push_back(j);
+                }
+                frame_graph.add([this, i]() {
+                    Timer t;
+                    stages[i].work();
+                    stages[i].ms = t.ms();
+                }, deps);
+            }
+        }
+
+        void declare_frame_stages() {
+            add_stage("prepare", F_CUR_ALL, F_NEXT_ALL,
+                [this]() { prepare(); });
+            add_stage("save_air_state", F_AIR_SOLVER, F_AIR_SNAPSHOT,
+                [this]() { save_air_state(); });
+            add_stage("compute_heat", F_CUR_POS | F_CUR_TYPE | F_CUR_HEAT | F_MAP_INDEX | F_SOLID | F_SOLID_HEAT, F_NEXT_HEAT | F_SOLID_HEAT,
+                [this]() { if (stage_due(heat_period, 1)) compute_heat(heat_period * K_DT); });
+            add_stage("compute_vel", F_CUR_POS | F_CUR_VEL | F_CUR_TYPE | F_CUR_SLEEP | F_MAP_INDEX | F_SOLID | F_AIR_SNAPSHOT, F_NEXT_VEL,
+                [this]() { compute_vel(); });
+            add_stage("compute_air_flow", F_CUR_POS | F_CUR_MOVEMENT | F_CUR_SLEEP | F_SOLID, F_AIR_SOLVER,
+                [this]() { if (stage_due(air_period, 0)) compute_air_flow(air_period * K_DT); });
+            add_stage("compute_position", F_CUR_POS | F_CUR_TYPE | F_CUR_SLEEP | F_MAP_INDEX | F_SOLID | F_NEXT_VEL, F_NEXT_VEL | F_NEXT_POS | F_NEXT_MOVEMENT | F_NEXT_TYPE,
+                [this]() { compute_position(); });
+            add_stage("handle_change_heat", F_MAP_INDEX | F_SOLID, F_HEAT_BRUSH,
+                [this]() { handle_change_heat(); });
+            add_stage("handle_new_particles", F_MAP_INDEX | F_SOLID, F_PARTICLE_BRUSH,
+                [this]() { handle_new_particles(); });
+            add_stage("complete", F_NEXT_ALL | F_HEAT_BRUSH | F_PARTICLE_BRUSH | F_AIR_SNAPSHOT, F_CUR_ALL | F_NEXT_ALL | F_HEAT_BRUSH | F_PARTICLE_BRUSH | F_SOLID | F_SOLID_HEAT,
+                [this]() { complete(); });
+        }
+
+#pragma endregion
+
+#pragma region 质量调节
+
+        // 一个可调的计算量：value 在 best（默认质量）与 worst 之间逐级调整，ms 为对应阶段平滑后的耗时
+        struct QualityKnob {
+            const char* name;
+            int stage;
+            int* value;
+            int best, worst;
+            float ms = 0;
+        };
+
+        vector<QualityKnob> knobs;
+        float smoothed_frame_ms = 0;
+        int governor_hold = 0;
+
+        int stage_index(const char* name) {
+            for (int i = 0; i < int(stages.size()); i++) {
+                if (strcmp(stages[i].name, name) == 0) return i;
+            }
+            assert(false);
+            return -1;
+        }
+
+        void declare_quality_knobs() {
+            knobs.push_back(QualityKnob{ "max liquid substeps", stage_index("compute_vel"), &liquid_iterations, K_LIQUID_ITERATIONS, K_LIQUID_MIN_ITERATIONS });
+            knobs.push_back(QualityKnob{ "heat slowdown", stage_index("compute_heat"), &heat_slowdown, 1, K_HEAT_MAX_SLOWDOWN });
+            knobs.push_back(QualityKnob{ "air pressure cycles", stage_index("compute_air_flow"), &airflow_solver.pressureIterations, K_AIR_PRESSURE_CYCLES, K_AIR_PRESSURE_MIN_CYCLES });
+        }
+
+        // 每帧结束后调用：平滑后的帧耗时超出 frame_budget_ms 时，将最耗时阶段的计算量降一级；
+        // 低于预算的 K_GOVERNOR_RECOVER 时，将已降级的阶段中最省时的一个升一级。每次调整后等待 K_GOVERNOR_HOLD_FRAMES 帧
+        // 没有预算（frame_budget_ms <= 0）时恢复默认质量
+        void govern_quality(float frame_ms) {
+            const float a = K_GOVERNOR_SMOOTHING;
+            smoothed_frame_ms = smoothed_frame_ms * (1 - a) + frame_ms * a;
+            for (auto& k : knobs) {
+                k.ms = k.ms * (1 - a) + stages[k.stage].ms * a;
+            }
+            if (frame_budget_ms <= 0) {
+                for (auto& k : knobs) {
+                    if (*k.value == k.best) continue;
+                    cout << "quality: " << k.name << " " << *k.value << " -> " << k.best << " (no budget)" << endl;
+                    *k.value = k.best;
+                }
+                governor_hold = 0;
+                return;
+            }
+            if (governor_hold > 0) {
+                governor_hold--;
+                return;
+            }
+
+            QualityKnob* pick = nullptr;
+            int dir = 0;
+            if (smoothed_frame_ms > frame_budget_ms) {
+                for (auto& k : knobs) {
+                    if (*k.value != k.worst && (!pick || k.ms > pick->ms)) pick = &k;
+                }
+                if (pick) dir = pick->worst > pick->best ? 1 : -1;
+            }
+            else if (smoothed_frame_ms < frame_budget_ms * K_GOVERNOR_RECOVER) {
+                for (auto& k : knobs) {
+                    if (*k.value != k.best && (!pick || k.ms < pick->ms)) pick = &k;
+                }
+                if (pick) dir = pick->best > pick->worst ? 1 : -1;
+            }
+            if (!pick) return;
+
+            int old = *pick->value;
+            *pick->value += dir;
+            governor_hold = K_GOVERNOR_HOLD_FRAMES;
+            cout << "quality: " << pick->name << " " << old << " -> " << *pick->value
+                << " (frame " << smoothed_frame_ms << " ms, budget " << frame_budget_ms << " ms)" << endl;
+        }
+
 #pragma endregion
 
         Array2D<float> pressure;
@@ -669,19 +1756,37 @@ namespace Simflow {
         GameModel() :
             state_cur(width * height),
             state_next(),
+            solid(width * height, width / K_AIRFLOW_DOWNSAMPLE * height / K_AIRFLOW_DOWNSAMPLE),
+            occupancy(width, height),
+            wake_mask(width * height),
             pressure(height, width),
             air_p_buf(height / K_AIRFLOW_DOWNSAMPLE, width / K_AIRFLOW_DOWNSAMPLE),
             air_vel_buf(height / K_AIRFLOW_DOWNSAMPLE, width / K_AIRFLOW_DOWNSAMPLE)
         {
             assert(width % K_AIRFLOW_DOWNSAMPLE == 0);
             assert(height % K_AIRFLOW_DOWNSAMPLE == 0);
-            assert(width % K_LIQUID_GRID_DOWNSAMPLE == 0);
-            assert(height % K_LIQUID_GRID_DOWNSAMPLE == 0);
 
             airflow_solver.init(height / K_AIRFLOW_DOWNSAMPLE, width / K_AIRFLOW_DOWNSAMPLE, K_DT);
+            airflow_solver.setPressureSolver(PRESSURE_MULTIGRID, K_AIR_PRESSURE_CYCLES, K_AIR_PRESSURE_TOLERANCE);
+            airflow_solver.setParallel(&parallel_line);
+            airflow_solver.setActiveTiles(K_AIR_TILE, K_AIR_SLEEP_VELOCITY);
             airflow_solver.reset();
+
+            declare_frame_stages();
+            build_frame_graph();
+            declare_quality_knobs();
         };
 
+        // 温度计算方式
+        enum class HeatSolver {
+            Particle, // 逐粒子迭代，每次迭代查询上下左右像素内的粒子
+            Grid, // 温度汇总到逐像素的网格上迭代，结束后写回粒子
+        };
+        HeatSolver heat_solver = HeatSolver::Grid;
+
+        // 每帧耗时预算（毫秒），大于 0 时质量调节器在运行时降低或恢复各阶段的计算量以维持预算，每次调整输出一行日志
+        float frame_budget_ms = 0;
+
 
 
         void update() {
@@ -689,21 +1794,12 @@ namespace Simflow {
 
             Timer t;
 
-            prepare();
-            save_air_state();
-
-            parallel_line.invoke({
-                function([this]() { compute_heat(); }),
-                function([this]() { compute_vel(); }),
-                function([this]() { compute_air_flow(); })
-                });
+            frame_graph.run(parallel_line);
 
-            compute_position();
-            handle_change_heat();
-            handle_new_particles();
-            complete();
+            float frame_ms = t.ms();
+            govern_quality(frame_ms);
 
-            cout << "frame time: " << t.ms() << endl;
+            cout << "frame time: " << frame_ms << endl;
             cout << "particles: " << state_cur.particles << endl;
         }
 
@@ -720,10 +1816,34 @@ namespace Simflow {
             const vector<ParticleType>& type;
             const vector<vec2>& position;
             const vector<float>& temperature;
+            const vector<vec2>& movement; // 本帧的位移
         };
 
+        struct StageTiming {
+            const char* name;
+            float ms;
+        };
+
+        // 最近一帧各阶段的耗时
+        vector<StageTiming> query_stage_timings() {
+            vector<StageTiming> res;
+            for (auto& st : stages) {
+                res.push_back(StageTiming{ st.name, st.ms });
+            }
+            return res;
+        }
+
         QueryParticleResult query_particles() {
-            return QueryParticleResult{ state_cur.p_type, state_cur.p_pos, state_cur.p_heat };
+            return QueryParticleResult{ state_cur.p_type, state_cur.p_pos, state_cur.p_heat, state_cur.p_movement };
+        }
+
+        struct QuerySolidResult {
+            const vector<int>& cells; // 固体像素的画布下标
+            const vector<float>& temperature; // 按画布下标
+        };
+
+        QuerySolidResult query_solids() {
+            return QuerySolidResult{ solid.cells, solid.heat };
         }
 
         const Array2D<float>& query_pressure() {
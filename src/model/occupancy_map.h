@@ -0,0 +1,82 @@
+﻿#pragma once
+#include "../glm/glm.hpp"
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+namespace Simflow {
+    using namespace std;
+    using namespace glm;
+
+    // 按位存储的像素占用图，附带两级汇总：第 k 级的一位表示一个 8^k x 8^k 像素块内是否有被占用的像素
+    // 射线遍历时若某级汇总为空，可以整块跳过
+    class OccupancyMap {
+    public:
+        static constexpr int LEVELS = 3;
+
+        OccupancyMap(int width, int height) {
+            for (int k = 0; k < LEVELS; k++) {
+                int shift = 3 * k;
+                levels[k].resize((width + (1 << shift) - 1) >> shift, (height + (1 << shift) - 1) >> shift);
+            }
+        }
+
+        // 块的边长（像素）
+        static constexpr int block_size(int level) { return 1 << (3 * level); }
+
+        // 只清除第 0 级，汇总由 build_summary() 重新生成
+        void clear() {
+            fill(levels[0].bits.begin(), levels[0].bits.end(), 0);
+        }
+
+        void set(ivec2 p) { levels[0].set(p.x, p.y); }
+        bool test(ivec2 p) const { return levels[0].test(p.x, p.y); }
+
+        // p 所在的第 level 级块内没有被占用的像素
+        bool empty_block(int level, ivec2 p) const {
+            return !levels[level].test(p.x >> (3 * level), p.y >> (3 * level));
+        }
+
+        // 由第 0 级逐级生成汇总：8 行按字取或，再把每 8 位压缩为 1 位
+        void build_summary() {
+            for (int k = 1; k < LEVELS; k++) {
+                const Level& src = levels[k - 1];
+                Level& dst = levels[k];
+                row_buf.resize(src.words_per_row);
+                for (int by = 0; by < dst.height; by++) {
+                    fill(row_buf.begin(), row_buf.end(), 0);
+                    for (int y = by * 8; y < std::min(by * 8 + 8, src.height); y++) {
+                        const uint64_t* row = &src.bits[y * src.words_per_row];
+                        for (int w = 0; w < src.words_per_row; w++) {
+                            row_buf[w] |= row[w];
+                        }
+                    }
+                    uint64_t* out = &dst.bits[by * dst.words_per_row];
+                    fill(out, out + dst.words_per_row, 0);
+                    for (int bx = 0; bx < dst.width; bx++) {
+                        int x = bx * 8;
+                        if ((row_buf[x >> 6] >> (x & 63)) & 0xFF) {
+                            out[bx >> 6] |= uint64_t(1) << (bx & 63);
+                        }
+                    }
+                }
+            }
+        }
+
+    private:
+        struct Level {
+            int width = 0, height = 0, words_per_row = 0;
+            vector<uint64_t> bits; // 行优先，每行补齐到整字
+            void resize(int w, int h) {
+                width = w;
+                height = h;
+                words_per_row = (w + 63) / 64;
+                bits.assign(words_per_row * h, 0);
+            }
+            bool test(int x, int y) const { return (bits[y * words_per_row + (x >> 6)] >> (x & 63)) & 1; }
+            void set(int x, int y) { bits[y * words_per_row + (x >> 6)] |= uint64_t(1) << (x & 63); }
+        };
+        Level levels[LEVELS];
+        vector<uint64_t> row_buf;
+    };
+}
@@ -0,0 +1,1130 @@
+#include "pressure_solver.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <complex>
+#include <vector>
+
+typedef std::complex<double> cd;
+static const double PI = 3.14159265358979323846;
+
+#define SWAP(value0,value) {float *tmp=value0;value0=value;value=tmp;}
+
+// complex product written out, std::complex falls back to a slow library call for NaN handling
+static inline cd cmul(cd a, cd b)
+{
+    return cd(a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real());
+}
+
+void gridBoundary(float* value, int rowSize, int colSize, float m)
+{
+    const float walls[4] = { m, m, m, m };
+    gridBoundary(value, rowSize, colSize, walls);
+}
+
+void gridBoundary(float* value, int rowSize, int colSize, const float m[4])
+{
+    for (int i = 1; i <= rowSize - 2; i++)
+    {
+        value[i] = value[rowSize + i] * m[SIDE_BOTTOM];
+        value[(colSize - 1) * rowSize + i] = value[(colSize - 2) * rowSize + i] * m[SIDE_TOP];
+    }
+
+    for (int j = 1; j <= colSize - 2; j++)
+    {
+        value[j * rowSize] = value[j * rowSize + 1] * m[SIDE_LEFT];
+        value[j * rowSize + rowSize - 1] = value[j * rowSize + rowSize - 2] * m[SIDE_RIGHT];
+    }
+
+    value[0] = (value[rowSize] + value[1]) / 2;
+    value[rowSize - 1] = (value[rowSize - 2] + value[2 * rowSize - 1]) / 2;
+    value[(colSize - 1) * rowSize] = (value[(colSize - 2) * rowSize] + value[(colSize - 1) * rowSize + 1]) / 2;
+    value[colSize * rowSize - 1] = (value[(colSize - 1) * rowSize - 1] + value[colSize * rowSize - 2]) / 2;
+}
+
+// one row of a Jacobi sweep, shared by the plain and the blocked sweeps so both round the same way
+static inline void jacobiRow(float* __restrict o, const float* __restrict s, const float* __restrict sB,
+    const float* __restrict sT, const float* __restrict r, float rhsScale, float a, float c, int rowSize)
+{
+    for (int i = 1; i <= rowSize - 2; i++)
+    {
+        o[i] = c * (rhsScale * r[i] + a * (s[i - 1] + s[i + 1] + sB[i] + sT[i]));
+    }
+}
+
+void gridJacobi(float* dst, const float* src, const float* rhs, float rhsScale, float a, float c, int rowSize, int colSize,
+    Simflow::Parallel* pool)
+{
+    gridForRows(pool, rowSize, colSize, [&](int j0, int j1)
+    {
+        for (int j = j0; j < j1; j++)
+        {
+            const float* s = src + j * rowSize;
+            jacobiRow(dst + j * rowSize, s, s - rowSize, s + rowSize, rhs + j * rowSize, rhsScale, a, c, rowSize);
+        }
+    });
+}
+
+void gridJacobiSweeps(float* p, float* tmp, const float* rhs, float rhsScale, float a, float c, const float m[4],
+    int rowSize, int colSize, int sweeps, std::vector<float>& scratch, Simflow::Parallel* pool)
+{
+    float* src = p;
+    float* dst = tmp;
+    if (rowSize * colSize < GRID_BLOCK_MIN_CELLS)
+    {
+        for (int k = 0; k < sweeps; k++)
+        {
+            gridJacobi(dst, src, rhs, rhsScale, a, c, rowSize, colSize, pool);
+            gridBoundary(dst, rowSize, colSize, m);
+            SWAP(src, dst);
+        }
+        if (src != p) memcpy(p, src, sizeof(float) * rowSize * colSize);
+        return;
+    }
+
+    // tiles of at least 8 halo widths, so the recomputed halo rows stay a small fraction of the work;
+    // each thread walks a contiguous run of tiles and reuses one scratch slot, which stays in its cache
+    int tileRows = gridBandRows(rowSize);
+    if (tileRows < 8 * GRID_BLOCK_SWEEPS) tileRows = 8 * GRID_BLOCK_SWEEPS;
+    int tiles = (colSize - 2 + tileRows - 1) / tileRows;
+    int slots = pool != 0 ? pool->workers() + 1 : 1;
+    if (slots > tiles) slots = tiles;
+    int tilesPerSlot = (tiles + slots - 1) / slots;
+    int slotCells = 2 * (tileRows + 2 * GRID_BLOCK_SWEEPS) * rowSize;
+    if ((int)scratch.size() < slots * slotCells) scratch.resize(slots * slotCells);
+
+    for (int done = 0; done < sweeps; done += GRID_BLOCK_SWEEPS)
+    {
+        int k = sweeps - done < GRID_BLOCK_SWEEPS ? sweeps - done : GRID_BLOCK_SWEEPS;
+        auto runTiles = [&](int t0, int t1)
+        {
+            float* cur = scratch.data() + (t0 / tilesPerSlot) * slotCells;
+            float* next = cur + slotCells / 2;
+            for (int t = t0; t < t1; t++)
+            {
+                // output rows [j0, j1) need the input rows [lo, hi); sweep s recomputes k - s halo rows on each side.
+                // The first sweep reads src and the last one writes dst, the ones between stay in the scratch slot
+                int j0 = 1 + t * tileRows;
+                int j1 = j0 + tileRows < colSize - 1 ? j0 + tileRows : colSize - 1;
+                int lo = j0 - k > 0 ? j0 - k : 0;
+                for (int s = 1; s <= k; s++)
+                {
+                    const float* in = s == 1 ? src : cur - lo * rowSize;
+                    float* out = s == k ? dst : next - lo * rowSize;
+                    int c0 = j0 - (k - s) > 1 ? j0 - (k - s) : 1;
+                    int c1 = j1 + (k - s) < colSize - 1 ? j1 + (k - s) : colSize - 1;
+                    for (int j = c0; j < c1; j++)
+                    {
+                        const float* row = in + j * rowSize;
+                        float* o = out + j * rowSize;
+                        jacobiRow(o, row, row - rowSize, row + rowSize, rhs + j * rowSize, rhsScale, a, c, rowSize);
+                        o[0] = o[1] * m[SIDE_LEFT];
+                        o[rowSize - 1] = o[rowSize - 2] * m[SIDE_RIGHT];
+                    }
+                    if (s == k) break;
+                    // the top and bottom rings as gridBoundary sets them; the corners are never read
+                    if (c0 == 1)
+                    {
+                        for (int i = 1; i <= rowSize - 2; i++) out[i] = out[rowSize + i] * m[SIDE_BOTTOM];
+                    }
+                    if (c1 == colSize - 1)
+                    {
+                        float* o = out + (colSize - 1) * rowSize;
+                        for (int i = 1; i <= rowSize - 2; i++) o[i] = o[i - rowSize] * m[SIDE_TOP];
+                    }
+                    SWAP(cur, next);
+                }
+            }
+        };
+        if (pool != 0) pool->parallel_for(0, tiles, tilesPerSlot, runTiles);
+        else runTiles(0, tiles);
+        gridBoundary(dst, rowSize, colSize, m);
+        SWAP(src, dst);
+    }
+    if (src != p) memcpy(p, src, sizeof(float) * rowSize * colSize);
+}
+
+// out = 4 * v - (sum of the 4 neighbours) over the interior, the ring of v must be set
+static void gridLaplacian(float* out, const float* v, int rowSize, int colSize, Simflow::Parallel* pool)
+{
+    gridForRows(pool, rowSize, colSize, [&](int j0, int j1)
+    {
+        for (int j = j0; j < j1; j++)
+        {
+            const float* __restrict s = v + j * rowSize;
+            const float* __restrict sB = s - rowSize;
+            const float* __restrict sT = s + rowSize;
+            float* __restrict o = out + j * rowSize;
+            for (int i = 1; i <= rowSize - 2; i++)
+            {
+                o[i] = 4.0f * s[i] - (s[i - 1] + s[i + 1] + sB[i] + sT[i]);
+            }
+        }
+    });
+}
+
+// out = A v with the faces to solid cells (open = 0) closed, the ring of v must be set
+static void gridLaplacianMasked(float* out, const float* v, const float* open, int rowSize, int colSize, Simflow::Parallel* pool)
+{
+    gridForRows(pool, rowSize, colSize, [&](int j0, int j1)
+    {
+        for (int j = j0; j < j1; j++)
+        {
+            const float* __restrict s = v + j * rowSize;
+            const float* __restrict sB = s - rowSize;
+            const float* __restrict sT = s + rowSize;
+            const float* __restrict o = open + j * rowSize;
+            const float* __restrict oB = o - rowSize;
+            const float* __restrict oT = o + rowSize;
+            float* __restrict out_ = out + j * rowSize;
+            for (int i = 1; i <= rowSize - 2; i++)
+            {
+                out_[i] = o[i] * (o[i - 1] * (s[i] - s[i - 1]) + o[i + 1] * (s[i] - s[i + 1]) + oB[i] * (s[i] - sB[i]) + oT[i] * (s[i] - sT[i]));
+            }
+        }
+    });
+}
+
+// out = A v with a weight per face, faceX[idx] between idx and idx + 1 and faceY[idx] between idx and idx + rowSize
+static void gridLaplacianFaces(float* out, const float* v, const float* faceX, const float* faceY, int rowSize, int colSize,
+    Simflow::Parallel* pool)
+{
+    gridForRows(pool, rowSize, colSize, [&](int j0, int j1)
+    {
+        for (int j = j0; j < j1; j++)
+        {
+            const float* __restrict s = v + j * rowSize;
+            const float* __restrict sB = s - rowSize;
+            const float* __restrict sT = s + rowSize;
+            const float* __restrict fx = faceX + j * rowSize;
+            const float* __restrict fyB = faceY + (j - 1) * rowSize;
+            const float* __restrict fy = faceY + j * rowSize;
+            float* __restrict o = out + j * rowSize;
+            for (int i = 1; i <= rowSize - 2; i++)
+            {
+                o[i] = fx[i - 1] * (s[i] - s[i - 1]) + fx[i] * (s[i] - s[i + 1]) + fyB[i] * (s[i] - sB[i]) + fy[i] * (s[i] - sT[i]);
+            }
+        }
+    });
+}
+
+// the wall factors of the ring cells next to interior cell (i, j), which fold into its diagonal
+static inline float wallSum(const float m[4], int i, int j, int rowSize, int colSize)
+{
+    float sum = 0.0f;
+    if (i == 1) sum += m[SIDE_LEFT];
+    if (i == rowSize - 2) sum += m[SIDE_RIGHT];
+    if (j == 1) sum += m[SIDE_BOTTOM];
+    if (j == colSize - 2) sum += m[SIDE_TOP];
+    return sum;
+}
+
+// the diagonal of interior cell (i, j): its open faces, less the wall factors of the ring neighbours
+static inline float gridDiagonal(const float* open, const float m[4], int i, int j, int rowSize, int colSize)
+{
+    int c = j * rowSize + i;
+    float faces = open[c - 1] + open[c + 1] + open[c - rowSize] + open[c + rowSize];
+    return open[c] * (faces - wallSum(m, i, j, rowSize, colSize));
+}
+
+void PressureSolver::init(int r, int c, float m)
+{
+    const float sides[4] = { m, m, m, m };
+    init(r, c, sides);
+}
+
+void PressureSolver::init(int r, int c, const float m[4])
+{
+    rowSize = r;
+    colSize = c;
+    totSize = r * c;
+    for (int side = 0; side < 4; side++) walls[side] = m[side];
+    open.clear();
+    fluidCells = (r - 2) * (c - 2);
+    setup();
+}
+
+void PressureSolver::setSolid(const unsigned char* solid)
+{
+    open.clear();
+    fluidCells = (rowSize - 2) * (colSize - 2);
+    if (solid == 0) return setup();
+    int solidCells = 0;
+    for (int j = 1; j <= colSize - 2; j++)
+    {
+        for (int i = j * rowSize + 1; i <= j * rowSize + rowSize - 2; i++) solidCells += solid[i] != 0;
+    }
+    if (solidCells == 0) return setup();
+
+    // fluid cells reached from the ring through fluid faces; a pocket sealed off by solid cells has no equation
+    // that fixes its pressure (and no solution unless its div sums to 0), so it is treated as solid
+    open.assign(totSize, 0.0f);
+    std::vector<int> stack;
+    for (int j = 0; j < colSize; j++)
+    {
+        for (int i = 0; i < rowSize; i++)
+        {
+            if (i == 0 || i == rowSize - 1 || j == 0 || j == colSize - 1)
+            {
+                open[j * rowSize + i] = 1.0f;
+                stack.push_back(j * rowSize + i);
+            }
+        }
+    }
+    while (!stack.empty())
+    {
+        int c = stack.back();
+        stack.pop_back();
+        int i = c % rowSize;
+        int j = c / rowSize;
+        const int next[4] = { i > 1 ? c - 1 : -1, i < rowSize - 2 ? c + 1 : -1, j > 1 ? c - rowSize : -1, j < colSize - 2 ? c + rowSize : -1 };
+        for (int k = 0; k < 4; k++)
+        {
+            int n = next[k];
+            if (n < 0 || open[n] != 0.0f || solid[n] != 0) continue;
+            if (n % rowSize == 0 || n % rowSize == rowSize - 1) continue;
+            open[n] = 1.0f;
+            stack.push_back(n);
+        }
+    }
+    fluidCells = 0;
+    for (int j = 1; j <= colSize - 2; j++)
+    {
+        for (int i = j * rowSize + 1; i <= j * rowSize + rowSize - 2; i++) fluidCells += open[i] != 0.0f;
+    }
+    setup();
+}
+
+void PressureSolver::laplacian(float* out, const float* v)
+{
+    if (open.empty()) gridLaplacian(out, v, rowSize, colSize, pool);
+    else gridLaplacianMasked(out, v, open.data(), rowSize, colSize, pool);
+}
+
+float PressureSolver::residual(const float* p, const float* div)
+{
+    if (fluidCells <= 0) return 0.0f;
+    const float* o = open.empty() ? 0 : open.data();
+    double rr = gridSumRows(pool, rowSize, colSize, [&](int j0, int j1)
+    {
+        double bandSum = 0.0;
+        for (int j = j0; j < j1; j++)
+        {
+            const float* s = p + j * rowSize;
+            const float* sB = s - rowSize;
+            const float* sT = s + rowSize;
+            const float* b = div + j * rowSize;
+            float rowSum = 0.0f;
+            if (o == 0)
+            {
+                for (int i = 1; i <= rowSize - 2; i++)
+                {
+                    float r = -b[i] - (4.0f * s[i] - (s[i - 1] + s[i + 1] + sB[i] + sT[i]));
+                    rowSum += r * r;
+                }
+            }
+            else
+            {
+                const float* oc = o + j * rowSize;
+                const float* oB = oc - rowSize;
+                const float* oT = oc + rowSize;
+                for (int i = 1; i <= rowSize - 2; i++)
+                {
+                    float a = oc[i] * (oc[i - 1] * (s[i] - s[i - 1]) + oc[i + 1] * (s[i] - s[i + 1]) + oB[i] * (s[i] - sB[i]) + oT[i] * (s[i] - sT[i]));
+                    float r = -oc[i] * b[i] - a;
+                    rowSum += r * r;
+                }
+            }
+            bandSum += rowSum;
+        }
+        return bandSum;
+    });
+    return (float)sqrt(rr / fluidCells);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Jacobi
+
+class JacobiPressureSolver : public PressureSolver
+{
+public:
+    int solve(float* p, const float* div, int maxIterations, float tolerance) override
+    {
+        // a residual pass costs about one sweep, so the tolerance is checked every few sweeps
+        // and the sweeps between two checks run as one temporally blocked pass
+        const int checkInterval = GRID_BLOCK_SWEEPS;
+        int k = 0;
+        while (k < maxIterations)
+        {
+            if (tolerance > 0.0f && residual(p, div) <= tolerance) break;
+            int sweeps = maxIterations - k < checkInterval ? maxIterations - k : checkInterval;
+            if (open.empty())
+            {
+                gridJacobiSweeps(p, tmp.data(), div, -1.0f, 1.0f, 0.25f, walls, rowSize, colSize, sweeps, blockScratch, pool);
+            }
+            else
+            {
+                for (int s = 0; s < sweeps; s++) maskedSweep(p, div);
+            }
+            k += sweeps;
+        }
+        lastResidual = residual(p, div);
+        return k;
+    }
+
+protected:
+    void setup() override
+    {
+        tmp.assign(totSize, 0.0f);
+        // each fluid cell moves to the mean of its open neighbours (ring ghosts included) less div / faces
+        invFaces.clear();
+        if (open.empty()) return;
+        invFaces.assign(totSize, 0.0f);
+        for (int j = 1; j <= colSize - 2; j++)
+        {
+            for (int i = 1; i <= rowSize - 2; i++)
+            {
+                int c = j * rowSize + i;
+                float faces = open[c - 1] + open[c + 1] + open[c - rowSize] + open[c + rowSize];
+                if (open[c] > 0.0f && faces > 0.0f) invFaces[c] = 1.0f / faces;
+            }
+        }
+    }
+
+    // one Jacobi sweep with the faces to solid cells closed, written to tmp and copied back
+    void maskedSweep(float* p, const float* div)
+    {
+        const float* o = open.data();
+        const float* inv = invFaces.data();
+        float* dst = tmp.data();
+        gridForRows(pool, rowSize, colSize, [&](int j0, int j1)
+        {
+            for (int j = j0; j < j1; j++)
+            {
+                for (int i = j * rowSize + 1; i <= j * rowSize + rowSize - 2; i++)
+                {
+                    dst[i] = inv[i] * (o[i - 1] * p[i - 1] + o[i + 1] * p[i + 1] + o[i - rowSize] * p[i - rowSize] + o[i + rowSize] * p[i + rowSize] - div[i]);
+                }
+            }
+        });
+        memcpy(p, dst, sizeof(float) * totSize);
+        gridBoundary(p, rowSize, colSize, walls);
+    }
+
+    std::vector<float> tmp;
+    std::vector<float> blockScratch;
+    std::vector<float> invFaces;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Multigrid: cell-centred levels, each halving the interior (rounded up), red-black Gauss-Seidel smoothing,
+// averaging restriction and bilinear prolongation; level l solves (4u - sum) / 4^l = f.
+// The wall term 1 - wall factor is a flux through the cell face, so it doubles with the cell size on each level;
+// the smoother folds it into the diagonal, which stays stable once a coarse wall turns strongly absorbing (wall < -3).
+// With solid cells each level weighs its faces instead: 1 between two fluid cells and 0 next to a solid one on the
+// finest level, the mean of the two fine faces it covers on a coarse one, so walls stay closed as the cells grow.
+
+class MultigridPressureSolver : public PressureSolver
+{
+public:
+    int solve(float* p, const float* div, int maxIterations, float tolerance) override
+    {
+        Level& top = levels[0];
+        memcpy(top.u.data(), p, sizeof(float) * totSize);
+        for (int i = 0; i < totSize; i++) top.f[i] = -div[i];
+        if (!open.empty())
+        {
+            for (int i = 0; i < totSize; i++) top.f[i] *= open[i];
+        }
+        gridBoundary(top.u.data(), rowSize, colSize, walls);
+        int k = 0;
+        lastResidual = residual(top.u.data(), div);
+        for (; k < maxIterations && lastResidual > tolerance; k++)
+        {
+            vcycle(0);
+            lastResidual = residual(top.u.data(), div);
+        }
+        memcpy(p, top.u.data(), sizeof(float) * totSize);
+        return k;
+    }
+
+protected:
+    struct Level
+    {
+        int rowSize;
+        int colSize;
+        float h2;
+        float wall[4];
+        std::vector<float> u, f, r, invDiag;
+        // weight of the face between cell idx and idx + 1 (faceX) or idx + rowSize (faceY), empty without a solid mask
+        std::vector<float> faceX, faceY;
+    };
+
+    void setup() override
+    {
+        levels.clear();
+        int r = rowSize;
+        int c = colSize;
+        float h2 = 1.0f;
+        float wall[4] = { walls[0], walls[1], walls[2], walls[3] };
+        while (true)
+        {
+            Level level;
+            level.rowSize = r;
+            level.colSize = c;
+            level.h2 = h2;
+            for (int side = 0; side < 4; side++) level.wall[side] = wall[side];
+            level.u.assign(r * c, 0.0f);
+            level.f.assign(r * c, 0.0f);
+            level.r.assign(r * c, 0.0f);
+            level.invDiag.assign(r * c, 0.0f);
+            if (!open.empty()) weighFaces(level);
+            for (int j = 1; j <= c - 2; j++)
+            {
+                for (int i = 1; i <= r - 2; i++)
+                {
+                    if (level.faceX.empty()) level.invDiag[j * r + i] = 1.0f / (4.0f - wallSum(wall, i, j, r, c));
+                    else
+                    {
+                        // a ring neighbour folds its wall factor in through the weight of its face
+                        int k = j * r + i;
+                        const float* fx = level.faceX.data();
+                        const float* fy = level.faceY.data();
+                        float diag = fx[k - 1] * (i == 1 ? 1.0f - wall[SIDE_LEFT] : 1.0f) + fx[k] * (i == r - 2 ? 1.0f - wall[SIDE_RIGHT] : 1.0f)
+                            + fy[k - r] * (j == 1 ? 1.0f - wall[SIDE_BOTTOM] : 1.0f) + fy[k] * (j == c - 2 ? 1.0f - wall[SIDE_TOP] : 1.0f);
+                        level.invDiag[k] = diag > 0.0f ? 1.0f / diag : 0.0f;
+                    }
+                }
+            }
+            levels.push_back(level);
+            if (r - 2 <= 2 || c - 2 <= 2) break;
+            r = (r - 2 + 1) / 2 + 2;
+            c = (c - 2 + 1) / 2 + 2;
+            h2 *= 4.0f;
+            for (int side = 0; side < 4; side++) wall[side] = 1.0f - 2.0f * (1.0f - wall[side]);
+        }
+    }
+
+    // face weights of a new level from the mask (the finest) or from the level before it
+    void weighFaces(Level& level)
+    {
+        int r = level.rowSize;
+        int c = level.colSize;
+        level.faceX.assign(r * c, 0.0f);
+        level.faceY.assign(r * c, 0.0f);
+        if (levels.empty())
+        {
+            for (int k = 0; k + 1 < totSize; k++) level.faceX[k] = open[k] * open[k + 1];
+            for (int k = 0; k + r < totSize; k++) level.faceY[k] = open[k] * open[k + r];
+            return;
+        }
+        // the faces of coarse column I on its right side lie right of fine column 2I, or of the last fine column
+        const Level& fine = levels.back();
+        int fr = fine.rowSize;
+        int nx = fine.rowSize - 2;
+        int ny = fine.colSize - 2;
+        for (int J = 1; J <= c - 2; J++)
+        {
+            for (int I = 0; I <= r - 2; I++)
+            {
+                int i = 2 * I < nx ? 2 * I : nx;
+                float sum = 0.0f;
+                int count = 0;
+                for (int j = 2 * J - 1; j <= 2 * J && j <= ny; j++, count++) sum += fine.faceX[j * fr + i];
+                level.faceX[J * r + I] = sum / count;
+            }
+        }
+        for (int J = 0; J <= c - 2; J++)
+        {
+            int j = 2 * J < ny ? 2 * J : ny;
+            for (int I = 1; I <= r - 2; I++)
+            {
+                float sum = 0.0f;
+                int count = 0;
+                for (int i = 2 * I - 1; i <= 2 * I && i <= nx; i++, count++) sum += fine.faceY[j * fr + i];
+                level.faceY[J * r + I] = sum / count;
+            }
+        }
+    }
+
+    void smooth(Level& l, int sweeps)
+    {
+        float* u = l.u.data();
+        const float* f = l.f.data();
+        const float* inv = l.invDiag.data();
+        int rs = l.rowSize;
+        gridBoundary(u, rs, l.colSize, 0.0f);
+        for (int s = 0; s < sweeps; s++)
+        {
+            for (int color = 0; color < 2; color++)
+            {
+                gridForRows(pool, rs, l.colSize, [&](int j0, int j1)
+                {
+                    for (int j = j0; j < j1; j++)
+                    {
+                        float* row = u + j * rs;
+                        const float* fr = f + j * rs;
+                        const float* ir = inv + j * rs;
+                        if (l.faceX.empty())
+                        {
+                            for (int i = ((1 + j) % 2 == color) ? 1 : 2; i <= rs - 2; i += 2)
+                            {
+                                row[i] = ir[i] * (row[i - 1] + row[i + 1] + row[i - rs] + row[i + rs] + l.h2 * fr[i]);
+                            }
+                        }
+                        else
+                        {
+                            const float* fx = l.faceX.data() + j * rs;
+                            const float* fy = l.faceY.data() + j * rs;
+                            for (int i = ((1 + j) % 2 == color) ? 1 : 2; i <= rs - 2; i += 2)
+                            {
+                                float sum = fx[i - 1] * row[i - 1] + fx[i] * row[i + 1] + fy[i - rs] * row[i - rs] + fy[i] * row[i + rs];
+                                row[i] = ir[i] * (sum + l.h2 * fr[i]);
+                            }
+                        }
+                    }
+                });
+            }
+        }
+        gridBoundary(u, rs, l.colSize, l.wall);
+    }
+
+    void vcycle(int level)
+    {
+        Level& l = levels[level];
+        if (level + 1 == (int)levels.size())
+        {
+            smooth(l, 30);
+            return;
+        }
+        smooth(l, 2);
+
+        // r = f - A u, restricted by averaging the (up to) four children of each coarse cell
+        if (l.faceX.empty()) gridLaplacian(l.r.data(), l.u.data(), l.rowSize, l.colSize, pool);
+        else gridLaplacianFaces(l.r.data(), l.u.data(), l.faceX.data(), l.faceY.data(), l.rowSize, l.colSize, pool);
+        float invH2 = 1.0f / l.h2;
+        gridForRows(pool, l.rowSize, l.colSize, [&](int j0, int j1)
+        {
+            for (int j = j0; j < j1; j++)
+            {
+                for (int i = j * l.rowSize + 1; i <= j * l.rowSize + l.rowSize - 2; i++) l.r[i] = l.f[i] - l.r[i] * invH2;
+            }
+        });
+
+        Level& c = levels[level + 1];
+        int nx = l.rowSize - 2;
+        int ny = l.colSize - 2;
+        gridForRows(pool, c.rowSize, c.colSize, [&](int j0, int j1)
+        {
+            for (int J = j0; J < j1; J++)
+            {
+                for (int I = 1; I <= c.rowSize - 2; I++)
+                {
+                    float sum = 0.0f;
+                    int count = 0;
+                    for (int j = 2 * J - 1; j <= 2 * J && j <= ny; j++)
+                    {
+                        for (int i = 2 * I - 1; i <= 2 * I && i <= nx; i++)
+                        {
+                            sum += l.r[j * l.rowSize + i];
+                            count++;
+                        }
+                    }
+                    c.f[J * c.rowSize + I] = sum / count;
+                }
+            }
+        });
+        memset(c.u.data(), 0, sizeof(float) * c.u.size());
+        vcycle(level + 1);
+
+        // bilinear prolongation: 3/4 from the parent and 1/4 from the next coarse cell on each axis,
+        // clamped to the interior at the walls
+        int ncx = c.rowSize - 2;
+        int ncy = c.colSize - 2;
+        gridForRows(pool, l.rowSize, l.colSize, [&](int j0, int j1)
+        {
+            for (int j = j0; j < j1; j++)
+            {
+                int J = (j + 1) / 2;
+                int Jn = (j % 2 == 1) ? J - 1 : J + 1;
+                if (Jn < 1) Jn = 1;
+                if (Jn > ncy) Jn = ncy;
+                const float* c0 = c.u.data() + J * c.rowSize;
+                const float* c1 = c.u.data() + Jn * c.rowSize;
+                float* row = l.u.data() + j * l.rowSize;
+                if (c.faceX.empty())
+                {
+                    for (int i = 1; i <= nx; i++)
+                    {
+                        int I = (i + 1) / 2;
+                        int In = (i % 2 == 1) ? I - 1 : I + 1;
+                        if (In < 1) In = 1;
+                        if (In > ncx) In = ncx;
+                        row[i] += 0.5625f * c0[I] + 0.1875f * (c0[In] + c1[I]) + 0.0625f * c1[In];
+                    }
+                    continue;
+                }
+                // a neighbour behind a closed coarse face gives way to the parent, in part for a partly open one
+                const float* fx = c.faceX.data() + J * c.rowSize;
+                const float* fy = c.faceY.data() + (Jn < J ? Jn : J) * c.rowSize;
+                for (int i = 1; i <= nx; i++)
+                {
+                    int I = (i + 1) / 2;
+                    int In = (i % 2 == 1) ? I - 1 : I + 1;
+                    if (In < 1) In = 1;
+                    if (In > ncx) In = ncx;
+                    float ax = In == I ? 0.0f : fx[In < I ? In : I];
+                    float ay = Jn == J ? 0.0f : fy[I];
+                    float x = c0[I] + ax * (c0[In] - c0[I]);
+                    float y = c0[I] + ay * (c1[I] - c0[I]);
+                    float xy = c0[I] + ax * ay * (c1[In] - c0[I]);
+                    row[i] += 0.5625f * c0[I] + 0.1875f * (x + y) + 0.0625f * xy;
+                }
+            }
+        });
+        smooth(l, 2);
+    }
+
+    std::vector<Level> levels;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// PCG with the modified incomplete Cholesky preconditioner MIC(0)
+
+class PcgPressureSolver : public PressureSolver
+{
+public:
+    int solve(float* p, const float* div, int maxIterations, float tolerance) override
+    {
+        float* r = res.data();
+        float* s = dir.data();
+        float* q = aDir.data();
+
+        gridBoundary(p, rowSize, colSize, walls);
+        laplacian(r, p);
+        const float* o = open.empty() ? 0 : open.data();
+        gridForRows(pool, rowSize, colSize, [&](int j0, int j1)
+        {
+            for (int j = j0; j < j1; j++)
+            {
+                for (int i = j * rowSize + 1; i <= j * rowSize + rowSize - 2; i++) r[i] = -div[i] - r[i];
+                if (o == 0) continue;
+                for (int i = j * rowSize + 1; i <= j * rowSize + rowSize - 2; i++) r[i] *= o[i];
+            }
+        });
+        float* z = zv.data();
+        precondition(z, r);
+        memcpy(s, z, sizeof(float) * totSize);
+        double rho = dot(r, s);
+        double cells = fluidCells > 0 ? fluidCells : 1;
+        double rr = dot(r, r);
+
+        int k = 0;
+        for (; k < maxIterations && rho > 0.0 && sqrt(rr / cells) > tolerance; k++)
+        {
+            gridBoundary(s, rowSize, colSize, walls);
+            laplacian(q, s);
+            double sq = dot(s, q);
+            if (sq <= 0.0) break;
+            float alpha = (float)(rho / sq);
+            gridForRows(pool, rowSize, colSize, [&](int j0, int j1)
+            {
+                for (int j = j0; j < j1; j++)
+                {
+                    for (int i = j * rowSize + 1; i <= j * rowSize + rowSize - 2; i++)
+                    {
+                        p[i] += alpha * s[i];
+                        r[i] -= alpha * q[i];
+                    }
+                }
+            });
+            rr = dot(r, r);
+
+            precondition(z, r);
+            double rhoNew = dot(r, z);
+            float beta = (float)(rhoNew / rho);
+            rho = rhoNew;
+            gridForRows(pool, rowSize, colSize, [&](int j0, int j1)
+            {
+                for (int j = j0; j < j1; j++)
+                {
+                    for (int i = j * rowSize + 1; i <= j * rowSize + rowSize - 2; i++) s[i] = z[i] + beta * s[i];
+                }
+            });
+        }
+        gridBoundary(p, rowSize, colSize, walls);
+        lastResidual = residual(p, div);
+        return k;
+    }
+
+protected:
+    void setup() override
+    {
+        res.assign(totSize, 0.0f);
+        dir.assign(totSize, 0.0f);
+        aDir.assign(totSize, 0.0f);
+        zv.assign(totSize, 0.0f);
+        temp.assign(totSize, 0.0f);
+        precon.assign(totSize, 0.0f);
+
+        // off-diagonals are -1 between interior cells, a wall neighbour folds its wall factor into the diagonal;
+        // precon stays 0 on the ring so the triangular solves need no bounds checks
+        const float tau = 0.97f;
+        const float sigma = 0.25f;
+        if (!open.empty())
+        {
+            setupMasked(tau, sigma);
+            return;
+        }
+        for (int j = 1; j <= colSize - 2; j++)
+        {
+            for (int i = 1; i <= rowSize - 2; i++)
+            {
+                float diag = 4.0f - wallSum(walls, i, j, rowSize, colSize);
+                float pl = precon[j * rowSize + i - 1];
+                float pb = precon[(j - 1) * rowSize + i];
+                float e = diag - pl * pl - pb * pb;
+                if (j + 1 <= colSize - 2) e -= tau * pl * pl;
+                if (i + 1 <= rowSize - 2) e -= tau * pb * pb;
+                if (e < sigma * diag) e = diag;
+                precon[j * rowSize + i] = 1.0f / sqrtf(e);
+            }
+        }
+    }
+
+    // the same with the off-diagonal between two cells scaled by open of both: 0 at a solid cell,
+    // whose precon stays 0 as well
+    void setupMasked(float tau, float sigma)
+    {
+        const float* o = open.data();
+        for (int j = 1; j <= colSize - 2; j++)
+        {
+            for (int i = 1; i <= rowSize - 2; i++)
+            {
+                int c = j * rowSize + i;
+                float diag = gridDiagonal(o, walls, i, j, rowSize, colSize);
+                if (diag <= 0.0f) continue;
+                float aL = o[c] * o[c - 1];
+                float aB = o[c] * o[c - rowSize];
+                float aLT = j + 1 <= colSize - 2 ? o[c - 1] * o[c - 1 + rowSize] : 0.0f;
+                float aBR = i + 1 <= rowSize - 2 ? o[c - rowSize] * o[c - rowSize + 1] : 0.0f;
+                float pl = precon[c - 1];
+                float pb = precon[c - rowSize];
+                float e = diag - aL * aL * pl * pl - aB * aB * pb * pb - tau * (aL * aLT * pl * pl + aB * aBR * pb * pb);
+                if (e < sigma * diag) e = diag;
+                precon[c] = 1.0f / sqrtf(e);
+            }
+        }
+    }
+
+    // z = M^-1 r by a forward and a backward triangular solve, the ring of z must be 0;
+    // each cell depends on the one before it, so this stays serial
+    void precondition(float* z, const float* r)
+    {
+        float* q = temp.data();
+        const float* pc = precon.data();
+        if (!open.empty())
+        {
+            preconditionMasked(z, r);
+            return;
+        }
+        for (int j = 1; j <= colSize - 2; j++)
+        {
+            for (int i = j * rowSize + 1; i <= j * rowSize + rowSize - 2; i++)
+            {
+                q[i] = (r[i] + pc[i - 1] * q[i - 1] + pc[i - rowSize] * q[i - rowSize]) * pc[i];
+            }
+        }
+        for (int j = colSize - 2; j >= 1; j--)
+        {
+            for (int i = j * rowSize + rowSize - 2; i >= j * rowSize + 1; i--)
+            {
+                z[i] = (q[i] + pc[i] * (z[i + 1] + z[i + rowSize])) * pc[i];
+            }
+        }
+    }
+
+    void preconditionMasked(float* z, const float* r)
+    {
+        float* q = temp.data();
+        const float* pc = precon.data();
+        const float* o = open.data();
+        for (int j = 1; j <= colSize - 2; j++)
+        {
+            for (int i = j * rowSize + 1; i <= j * rowSize + rowSize - 2; i++)
+            {
+                q[i] = (r[i] + o[i] * (o[i - 1] * pc[i - 1] * q[i - 1] + o[i - rowSize] * pc[i - rowSize] * q[i - rowSize])) * pc[i];
+            }
+        }
+        for (int j = colSize - 2; j >= 1; j--)
+        {
+            for (int i = j * rowSize + rowSize - 2; i >= j * rowSize + 1; i--)
+            {
+                z[i] = (q[i] + pc[i] * o[i] * (o[i + 1] * z[i + 1] + o[i + rowSize] * z[i + rowSize])) * pc[i];
+            }
+        }
+    }
+
+    double dot(const float* a, const float* b)
+    {
+        return gridSumRows(pool, rowSize, colSize, [&](int j0, int j1)
+        {
+            double bandSum = 0.0;
+            for (int j = j0; j < j1; j++)
+            {
+                float row = 0.0f;
+                for (int i = j * rowSize + 1; i <= j * rowSize + rowSize - 2; i++) row += a[i] * b[i];
+                bandSum += row;
+            }
+            return bandSum;
+        });
+    }
+
+    std::vector<float> res, dir, aDir, zv, temp, precon;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// DCT: the Neumann Laplacian on n cells is diagonal in the DCT-II basis with eigenvalues 2 - 2cos(pi k / n);
+// runs serially, the line transforms share one scratch buffer
+
+// complex DFT of any length, radix-2 for powers of two and Bluestein's chirp-z otherwise
+class Fft
+{
+public:
+    void init(int len)
+    {
+        n = len;
+        m = 1;
+        while (m < n) m *= 2;
+        if (m != n)
+        {
+            m = 1;
+            while (m < 2 * n - 1) m *= 2;
+        }
+        twiddle.resize(m / 2);
+        for (int k = 0; k < m / 2; k++) twiddle[k] = std::polar(1.0, -2.0 * PI * k / m);
+        if (m != n)
+        {
+            chirp.resize(n);
+            for (int k = 0; k < n; k++)
+            {
+                long long k2 = (long long)k * k % (2LL * n);
+                chirp[k] = std::polar(1.0, -PI * (double)k2 / n);
+            }
+            chirpFft.assign(m, cd(0.0, 0.0));
+            chirpFft[0] = std::conj(chirp[0]);
+            for (int k = 1; k < n; k++) chirpFft[k] = chirpFft[m - k] = std::conj(chirp[k]);
+            radix2(chirpFft.data(), false);
+            work.resize(m);
+        }
+    }
+
+    // in place, unnormalised; inverse uses exp(+i...)
+    void transform(cd* a, bool inverse)
+    {
+        if (m == n)
+        {
+            radix2(a, inverse);
+            return;
+        }
+        // inverse DFT is the conjugate of the forward DFT of the conjugate
+        for (int k = 0; k < n; k++) work[k] = cmul(inverse ? std::conj(a[k]) : a[k], chirp[k]);
+        for (int k = n; k < m; k++) work[k] = cd(0.0, 0.0);
+        radix2(work.data(), false);
+        for (int k = 0; k < m; k++) work[k] = cmul(work[k], chirpFft[k]);
+        radix2(work.data(), true);
+        double inv = 1.0 / m;
+        for (int k = 0; k < n; k++)
+        {
+            cd v = cmul(work[k], chirp[k]) * inv;
+            a[k] = inverse ? std::conj(v) : v;
+        }
+    }
+
+private:
+    void radix2(cd* a, bool inverse)
+    {
+        for (int i = 1, j = 0; i < m; i++)
+        {
+            int bit = m >> 1;
+            for (; j & bit; bit >>= 1) j ^= bit;
+            j ^= bit;
+            if (i < j) std::swap(a[i], a[j]);
+        }
+        for (int len = 2; len <= m; len *= 2)
+        {
+            int step = m / len;
+            for (int i = 0; i < m; i += len)
+            {
+                for (int k = 0; k < len / 2; k++)
+                {
+                    cd w = inverse ? std::conj(twiddle[k * step]) : twiddle[k * step];
+                    cd u = a[i + k];
+                    cd v = cmul(a[i + k + len / 2], w);
+                    a[i + k] = u + v;
+                    a[i + k + len / 2] = u - v;
+                }
+            }
+        }
+    }
+
+    int n;
+    int m;
+    std::vector<cd> twiddle, chirp, chirpFft, work;
+};
+
+// unnormalised DCT-II and its exact inverse via one complex DFT of the same length (Makhoul's reordering);
+// the reordered sequence is real, so two lines share one DFT as its real and imaginary parts (y may be 0)
+class Dct
+{
+public:
+    void init(int len)
+    {
+        n = len;
+        fft.init(n);
+        shift.resize(n);
+        for (int k = 0; k < n; k++) shift[k] = std::polar(1.0, -PI * k / (2.0 * n));
+        v.resize(n);
+    }
+
+    void forward(double* x, double* y)
+    {
+        for (int k = 0; 2 * k < n; k++) v[k] = cd(x[2 * k], y ? y[2 * k] : 0.0);
+        for (int k = 0; 2 * k + 1 < n; k++) v[n - 1 - k] = cd(x[2 * k + 1], y ? y[2 * k + 1] : 0.0);
+        fft.transform(v.data(), false);
+        for (int k = 0; k < n; k++)
+        {
+            cd z = v[k];
+            cd zc = std::conj(v[k == 0 ? 0 : n - k]);
+            x[k] = cmul((z + zc) * 0.5, shift[k]).real();
+            if (y) y[k] = cmul(cd(z.imag() - zc.imag(), zc.real() - z.real()) * 0.5, shift[k]).real();
+        }
+    }
+
+    void inverse(double* x, double* y)
+    {
+        for (int k = 0; k < n; k++)
+        {
+            cd a = cmul(cd(x[k], k == 0 ? 0.0 : -x[n - k]), std::conj(shift[k]));
+            cd b = y ? cmul(cd(y[k], k == 0 ? 0.0 : -y[n - k]), std::conj(shift[k])) : cd(0.0, 0.0);
+            v[k] = cd(a.real() - b.imag(), a.imag() + b.real());
+        }
+        fft.transform(v.data(), true);
+        double inv = 1.0 / n;
+        for (int k = 0; 2 * k < n; k++)
+        {
+            x[2 * k] = v[k].real() * inv;
+            if (y) y[2 * k] = v[k].imag() * inv;
+        }
+        for (int k = 0; 2 * k + 1 < n; k++)
+        {
+            x[2 * k + 1] = v[n - 1 - k].real() * inv;
+            if (y) y[2 * k + 1] = v[n - 1 - k].imag() * inv;
+        }
+    }
+
+private:
+    int n;
+    Fft fft;
+    std::vector<cd> shift, v;
+};
+
+class DctPressureSolver : public PressureSolver
+{
+public:
+    int solve(float* p, const float* div, int, float) override
+    {
+        int nx = rowSize - 2;
+        int ny = colSize - 2;
+        for (int j = 0; j < ny; j++)
+        {
+            for (int i = 0; i < nx; i++) grid[j * nx + i] = -div[(j + 1) * rowSize + i + 1];
+        }
+
+        transformRows(true);
+        transformColumns(true);
+        for (int j = 0; j < ny; j++)
+        {
+            for (int i = 0; i < nx; i++)
+            {
+                double lambda = eigenX[i] + eigenY[j];
+                grid[j * nx + i] = lambda > 0.0 ? grid[j * nx + i] / lambda : 0.0;
+            }
+        }
+        transformColumns(false);
+        transformRows(false);
+
+        for (int j = 0; j < ny; j++)
+        {
+            for (int i = 0; i < nx; i++) p[(j + 1) * rowSize + i + 1] = (float)grid[j * nx + i];
+        }
+        gridBoundary(p, rowSize, colSize, walls);
+        lastResidual = residual(p, div);
+        return 1;
+    }
+
+protected:
+    void setup() override
+    {
+        int nx = rowSize - 2;
+        int ny = colSize - 2;
+        dctX.init(nx);
+        dctY.init(ny);
+        eigenX.resize(nx);
+        eigenY.resize(ny);
+        for (int k = 0; k < nx; k++) eigenX[k] = 2.0 - 2.0 * cos(PI * k / nx);
+        for (int k = 0; k < ny; k++) eigenY[k] = 2.0 - 2.0 * cos(PI * k / ny);
+        grid.resize(nx * ny);
+        column.resize(2 * ny);
+    }
+
+    void transformRows(bool forward)
+    {
+        int nx = rowSize - 2;
+        int ny = colSize - 2;
+        for (int j = 0; j < ny; j += 2)
+        {
+            double* x = grid.data() + j * nx;
+            double* y = j + 1 < ny ? x + nx : 0;
+            if (forward) dctX.forward(x, y);
+            else dctX.inverse(x, y);
+        }
+    }
+
+    void transformColumns(bool forward)
+    {
+        int nx = rowSize - 2;
+        int ny = colSize - 2;
+        double* x = column.data();
+        for (int i = 0; i < nx; i += 2)
+        {
+            double* y = i + 1 < nx ? x + ny : 0;
+            for (int j = 0; j < ny; j++)
+            {
+                x[j] = grid[j * nx + i];
+                if (y) y[j] = grid[j * nx + i + 1];
+            }
+            if (forward) dctY.forward(x, y);
+            else dctY.inverse(x, y);
+            for (int j = 0; j < ny; j++)
+            {
+                grid[j * nx + i] = x[j];
+                if (y) grid[j * nx + i + 1] = y[j];
+            }
+        }
+    }
+
+    Dct dctX, dctY;
+    std::vector<double> eigenX, eigenY, grid, column;
+};
+
+PressureSolver* PressureSolver::create(PressureSolverType type)
+{
+    switch (type)
+    {
+    case PRESSURE_MULTIGRID: return new MultigridPressureSolver();
+    case PRESSURE_PCG: return new PcgPressureSolver();
+    case PRESSURE_DCT: return new DctPressureSolver();
+    default: return new JacobiPressureSolver();
+    }
+}
@@ -0,0 +1,141 @@
+#ifndef __PRESSURESOLVER_H__
+#define __PRESSURESOLVER_H__
+
+#include "../common/parallel.h"
+#include <vector>
+
+// Pressure Poisson solvers for AirSolver::projection.
+//
+// All grids use the AirSolver layout: idx = y * rowSize + x, with a one-cell ring
+// (x = 0, x = rowSize - 1, y = 0, y = colSize - 1) around the interior. On the interior
+// the solvers approximate
+//     4 * p(x, y) - p(x - 1, y) - p(x + 1, y) - p(x, y - 1) - p(x, y + 1) = -div(x, y)
+// and every ring cell follows its interior neighbour scaled by the wall factor of its side
+// (the same wallScale on every side for AirSolver::setBoundary).
+// With a solid mask the faces between a fluid and a solid cell are closed (no flux) and solid cells take no part:
+//     sum over the open faces of (p(x, y) - p(neighbour)) = -div(x, y)
+// Fluid cells sealed off from the ring by solid cells count as solid, their pressure would be fixed by nothing.
+
+// Passes over the interior run in bands of rows, on a Simflow::Parallel pool when one is given.
+// Band bounds depend only on the grid size and every pass reads what the previous pass wrote (ping-pong or
+// red-black), so results are the same serially and on any number of threads; band sums are added in band order.
+const int GRID_BAND_CELLS = 16384; // about this many cells per band
+
+inline int gridBandRows(int rowSize)
+{
+    int rows = GRID_BAND_CELLS / rowSize;
+    return rows > 0 ? rows : 1;
+}
+
+// f(j0, j1) for each band [j0, j1) of the rows [jBegin, jEnd)
+template<typename F>
+void gridForRowRange(Simflow::Parallel *pool, int rowSize, int jBegin, int jEnd, F &&f)
+{
+    int grain = gridBandRows(rowSize);
+    if (pool != 0) pool->parallel_for(jBegin, jEnd, grain, f);
+    else
+    {
+        for (int j = jBegin; j < jEnd; j += grain) f(j, j + grain < jEnd ? j + grain : jEnd);
+    }
+}
+
+// f(j0, j1) for each band [j0, j1) of the interior rows
+template<typename F>
+void gridForRows(Simflow::Parallel *pool, int rowSize, int colSize, F &&f)
+{
+    gridForRowRange(pool, rowSize, 1, colSize - 1, f);
+}
+
+// sum of f(j0, j1) (a double) over the bands of the rows [jBegin, jEnd)
+template<typename F>
+double gridSumRowRange(Simflow::Parallel *pool, int rowSize, int jBegin, int jEnd, F &&f)
+{
+    int grain = gridBandRows(rowSize);
+    if (pool != 0) return pool->parallel_reduce(jBegin, jEnd, grain, 0.0, f, [](double a, double b) { return a + b; });
+    double sum = 0.0;
+    for (int j = jBegin; j < jEnd; j += grain) sum += f(j, j + grain < jEnd ? j + grain : jEnd);
+    return sum;
+}
+
+// sum of f(j0, j1) (a double) over the bands of the interior rows
+template<typename F>
+double gridSumRows(Simflow::Parallel *pool, int rowSize, int colSize, F &&f)
+{
+    return gridSumRowRange(pool, rowSize, 1, colSize - 1, f);
+}
+
+// sides of the ring, indexing the per-side wall factors
+enum GridSide
+{
+    SIDE_LEFT,   // x = 0
+    SIDE_RIGHT,  // x = rowSize - 1
+    SIDE_BOTTOM, // y = 0
+    SIDE_TOP,    // y = colSize - 1
+};
+
+// the ring of value follows the interior scaled by m, corners take the average of their two neighbours
+void gridBoundary(float *value, int rowSize, int colSize, float m);
+// the same with a factor per side: m[SIDE_LEFT], m[SIDE_RIGHT], m[SIDE_BOTTOM], m[SIDE_TOP]
+void gridBoundary(float *value, int rowSize, int colSize, const float m[4]);
+
+// dst = c * (rhsScale * rhs + a * (sum of the 4 neighbours in src)) over the interior; one plain Jacobi sweep
+void gridJacobi(float *dst, const float *src, const float *rhs, float rhsScale, float a, float c, int rowSize, int colSize,
+    Simflow::Parallel *pool = 0);
+
+// Temporal blocking: on grids too large for the cache, several Jacobi sweeps are applied to one tile of rows
+// (plus a halo of one row per sweep on each side, recomputed by both neighbours) before moving to the next tile.
+const int GRID_BLOCK_MIN_CELLS = 1 << 17; // smaller grids stay in cache and sweep the whole grid at a time
+const int GRID_BLOCK_SWEEPS = 4; // max sweeps applied to a tile per pass over the grid
+
+// sweeps rounds of gridJacobi followed by gridBoundary(m), ping-ponging between p and tmp; the result ends in p.
+// Large grids are temporally blocked, the result is the same as the plain sweeps. scratch holds the tiles.
+void gridJacobiSweeps(float *p, float *tmp, const float *rhs, float rhsScale, float a, float c, const float m[4],
+    int rowSize, int colSize, int sweeps, std::vector<float> &scratch, Simflow::Parallel *pool = 0);
+
+enum PressureSolverType
+{
+    PRESSURE_JACOBI,    // plain Jacobi sweeps, one sweep per iteration
+    PRESSURE_MULTIGRID, // geometric multigrid, one V-cycle per iteration; a solid mask slows it (walls only coarsen as face weights)
+    PRESSURE_PCG,       // conjugate gradient with MIC(0) preconditioning, one CG step per iteration
+    PRESSURE_DCT,       // direct solve in the cosine basis, exact when every wall factor is 1 (closed empty box); iterations, tolerance and the solid mask are ignored
+};
+
+class PressureSolver
+{
+public:
+    PressureSolver() : pool(0) {}
+    virtual ~PressureSolver() {}
+    void init(int r, int c, float m);
+    // a wall factor per side, e.g. 0 (p = 0 outside, an open side) where the grid is a window into a larger one
+    void init(int r, int c, const float m[4]);
+    void setParallel(Simflow::Parallel *parallel) { pool = parallel; }
+    // solid[idx] != 0 marks a solid interior cell, 0 clears the mask; init clears it too
+    void setSolid(const unsigned char *solid);
+
+    // p holds the initial guess on entry (ring included) and the result on return, ring updated;
+    // stops once residual(p, div) <= tolerance (never when tolerance <= 0) or after maxIterations steps,
+    // returns the steps run and leaves the final residual in lastResidual
+    virtual int solve(float *p, const float *div, int maxIterations, float tolerance) = 0;
+
+    // root mean square of -div - A p over the fluid interior: the divergence the projection leaves per cell
+    float residual(const float *p, const float *div);
+
+    float lastResidual;
+
+    static PressureSolver *create(PressureSolverType type);
+
+protected:
+    virtual void setup() {}
+    // out = A v over the interior, the ring of v must be set
+    void laplacian(float *out, const float *v);
+
+    int rowSize;
+    int colSize;
+    int totSize;
+    float walls[4]; // wall factor of each GridSide
+    std::vector<float> open; // 1 on fluid and 0 on solid cells (the ring is fluid), empty without a solid mask
+    int fluidCells;
+    Simflow::Parallel *pool;
+};
+
+#endif
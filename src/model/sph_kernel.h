@@ -0,0 +1,132 @@
+﻿#pragma once
+#include "../glm/glm.hpp"
+#include "constant.h"
+#include <vector>
+#include <cmath>
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace Simflow {
+    using namespace std;
+    using namespace glm;
+
+    // 液体粒子间的斥力大小，dist 为距离除以 K_LIQUID_RADIUS
+    inline float kernel_fn_water(float dist) {
+        return 180 * pow(K_LIQUID_RADIUS - dist, 2);
+    }
+
+    // kernel_fn_water 的查找表：按距离 r 把 [0, K_LIQUID_RADIUS] 等分，查表时线性插值
+    class WaterKernelTable {
+    public:
+        static constexpr int SIZE = 1024;
+
+        WaterKernelTable() : values(SIZE + 2) {
+            for (int i = 0; i < SIZE + 2; i++) {
+                values[i] = kernel_fn_water(i * step() / K_LIQUID_RADIUS);
+            }
+        }
+
+        static float step() { return K_LIQUID_RADIUS / SIZE; }
+
+        // 0 <= r < K_LIQUID_RADIUS
+        float operator()(float r) const {
+            float t = r * (1 / step());
+            int i = int(t);
+            return values[i] + (t - i) * (values[i + 1] - values[i]);
+        }
+
+        const float* data() const { return values.data(); }
+
+    private:
+        vector<float> values;
+    };
+
+    // 邻居对粒子的作用力之和（未除以粒子自身的质量）：
+    // 第 k 个邻居的相对位移为 (dx[k], dy[k])、质量为 mass[k]，距离不小于 K_LIQUID_RADIUS 的邻居不产生作用力
+    // 调用方需保证距离大于 0.01，过近的邻居另行处理
+
+    // 参考实现，与逐个邻居计算 -normalize(d) * m * kernel_fn_water(r / K_LIQUID_RADIUS) 相同
+    inline vec2 water_force_reference(const float* dx, const float* dy, const float* mass, int n) {
+        vec2 f = vec2();
+        for (int k = 0; k < n; k++) {
+            vec2 d(dx[k], dy[k]);
+            float r = length(d);
+            if (r < K_LIQUID_RADIUS) {
+                f += -normalize(d) * mass[k] * kernel_fn_water(r / K_LIQUID_RADIUS);
+            }
+        }
+        return f;
+    }
+
+    // 查表实现，按编译目标选择 AVX-512 / AVX2 / 标量
+    inline vec2 water_force(const WaterKernelTable& table, const float* dx, const float* dy, const float* mass, int n) {
+        const float r2_max = K_LIQUID_RADIUS * K_LIQUID_RADIUS;
+        int k = 0;
+        float fx = 0, fy = 0;
+#if defined(__AVX512F__)
+        __m512 sx = _mm512_setzero_ps(), sy = _mm512_setzero_ps();
+        const __m512 v_r2_max = _mm512_set1_ps(r2_max), v_inv_step = _mm512_set1_ps(1 / table.step());
+        for (; k < n; k += 16) {
+            // 末尾不足 16 个时只启用前 n - k 个通道
+            __mmask16 lanes = n - k >= 16 ? __mmask16(0xFFFF) : __mmask16((1u << (n - k)) - 1);
+            __m512 x = _mm512_maskz_loadu_ps(lanes, dx + k);
+            __m512 y = _mm512_maskz_loadu_ps(lanes, dy + k);
+            __m512 m = _mm512_maskz_loadu_ps(lanes, mass + k);
+            __m512 r2 = _mm512_fmadd_ps(x, x, _mm512_mul_ps(y, y));
+            lanes = _mm512_mask_cmp_ps_mask(lanes, r2, v_r2_max, _CMP_LT_OQ);
+            if (!lanes) continue;
+            __m512 r = _mm512_sqrt_ps(r2);
+            __m512 t = _mm512_mul_ps(r, v_inv_step);
+            __m512i i = _mm512_cvttps_epi32(t);
+            __m512 frac = _mm512_sub_ps(t, _mm512_cvtepi32_ps(i));
+            __m512 a = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), lanes, i, table.data(), 4);
+            __m512 b = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), lanes, i, table.data() + 1, 4);
+            __m512 v = _mm512_fmadd_ps(frac, _mm512_sub_ps(b, a), a);
+            __m512 s = _mm512_maskz_div_ps(lanes, _mm512_mul_ps(m, v), r);
+            sx = _mm512_fnmadd_ps(x, s, sx);
+            sy = _mm512_fnmadd_ps(y, s, sy);
+        }
+        fx = _mm512_reduce_add_ps(sx);
+        fy = _mm512_reduce_add_ps(sy);
+#elif defined(__AVX2__)
+        __m256 sx = _mm256_setzero_ps(), sy = _mm256_setzero_ps();
+        const __m256 v_r2_max = _mm256_set1_ps(r2_max), v_inv_step = _mm256_set1_ps(1 / table.step());
+        for (; k + 8 <= n; k += 8) {
+            __m256 x = _mm256_loadu_ps(dx + k);
+            __m256 y = _mm256_loadu_ps(dy + k);
+            __m256 m = _mm256_loadu_ps(mass + k);
+            __m256 r2 = _mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y));
+            __m256 lanes = _mm256_cmp_ps(r2, v_r2_max, _CMP_LT_OQ);
+            if (_mm256_testz_ps(lanes, lanes)) continue;
+            // 关闭的通道距离可能很大，先置零以免下标越界
+            __m256 r = _mm256_sqrt_ps(_mm256_and_ps(r2, lanes));
+            __m256 t = _mm256_mul_ps(r, v_inv_step);
+            __m256i i = _mm256_cvttps_epi32(t);
+            __m256 frac = _mm256_sub_ps(t, _mm256_cvtepi32_ps(i));
+            __m256 a = _mm256_i32gather_ps(table.data(), i, 4);
+            __m256 b = _mm256_i32gather_ps(table.data() + 1, i, 4);
+            __m256 v = _mm256_add_ps(a, _mm256_mul_ps(frac, _mm256_sub_ps(b, a)));
+            __m256 s = _mm256_and_ps(_mm256_div_ps(_mm256_mul_ps(m, v), r), lanes);
+            sx = _mm256_sub_ps(sx, _mm256_mul_ps(x, s));
+            sy = _mm256_sub_ps(sy, _mm256_mul_ps(y, s));
+        }
+        alignas(32) float bx[8], by[8];
+        _mm256_store_ps(bx, sx);
+        _mm256_store_ps(by, sy);
+        for (int j = 0; j < 8; j++) {
+            fx += bx[j];
+            fy += by[j];
+        }
+#endif
+        for (; k < n; k++) {
+            float r2 = dx[k] * dx[k] + dy[k] * dy[k];
+            if (r2 >= r2_max) continue;
+            float r = sqrt(r2);
+            float s = mass[k] * table(r) / r;
+            fx -= dx[k] * s;
+            fy -= dy[k] * s;
+        }
+        return vec2(fx, fy);
+    }
+}
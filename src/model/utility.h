@@ -13,6 +13,28 @@ namespace Simflow {
         return float(rand()) / RAND_MAX * (to - from) + from;
     }
 
+    inline unsigned int hash_u32(unsigned int x) {
+        x ^= x >> 16;
+        x *= 0x7feb352dU;
+        x ^= x >> 15;
+        x *= 0x846ca68bU;
+        x ^= x >> 16;
+        return x;
+    }
+
+    inline unsigned int hash_combine(unsigned int a, unsigned int b) {
+        return hash_u32(a ^ (b + 0x9e3779b9U + (a << 6) + (a >> 2)));
+    }
+
+    // deterministic counterpart of random(): same seed, same value on any thread
+    inline float hash_random(unsigned int seed, float from, float to) {
+        return float(hash_u32(seed) & 0xFFFFFF) / float(0xFFFFFF) * (to - from) + from;
+    }
+
+    inline int hash_sample(unsigned int seed, int from_inclusive, int to_inclusive) {
+        return int(hash_u32(seed) % unsigned(to_inclusive - from_inclusive + 1)) + from_inclusive;
+    }
+
     inline ivec2 f2i(vec2 v) { return v + vec2(0.5); };
     inline int f2i(float v) { return v + 0.5; }
 
@@ -0,0 +1,41 @@
+#include "test.h"
+#include "../model/sph_kernel.h"
+#include "../model/utility.h"
+
+using namespace Simflow;
+
+TEST_CASE(water_kernel_table) {
+    WaterKernelTable table;
+    for (int i = 0; i < 1000; i++) {
+        float r = hash_random(i, 0, K_LIQUID_RADIUS * 0.999f);
+        float expected = kernel_fn_water(r / K_LIQUID_RADIUS);
+        expect(abs(table(r) - expected) <= 1e-3f * kernel_fn_water(0), "kernel table differs from kernel_fn_water");
+    }
+}
+
+// 各种邻居数（覆盖向量宽度的整数倍与尾部），距离在 (0.01, 1.25 * K_LIQUID_RADIUS) 内随机
+TEST_CASE(water_force_matches_reference) {
+    WaterKernelTable table;
+    vector<float> dx, dy, mass;
+    for (int n = 0; n <= 40; n++) {
+        for (int trial = 0; trial < 20; trial++) {
+            dx.resize(n);
+            dy.resize(n);
+            mass.resize(n);
+            float bound = 0;
+            for (int k = 0; k < n; k++) {
+                unsigned int seed = hash_combine(hash_combine(n, trial), k) * 4;
+                float r = hash_random(seed, 0.011f, K_LIQUID_RADIUS * 1.25f);
+                float angle = hash_random(seed + 1, 0, 6.2831853f);
+                dx[k] = r * cos(angle);
+                dy[k] = r * sin(angle);
+                mass[k] = hash_random(seed + 2, 0.5f, 2.f);
+                bound += mass[k] * kernel_fn_water(0);
+            }
+            vec2 ref = water_force_reference(dx.data(), dy.data(), mass.data(), n);
+            vec2 simd = water_force(table, dx.data(), dy.data(), mass.data(), n);
+            expect(length(simd - ref) <= 1e-5f * bound + 1e-6f,
+                "water_force differs from reference with " + to_string(n) + " neighbors");
+        }
+    }
+}
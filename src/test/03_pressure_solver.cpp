@@ -0,0 +1,108 @@
+#include "test.h"
+#include "../model/pressure_solver.h"
+#include "../model/utility.h"
+#include "../common/parallel.h"
+#include <cmath>
+#include <memory>
+
+using namespace Simflow;
+
+// 内部为确定的随机散度，环与固体格为 0；zero_mean 时减去均值（封闭盒子有解的条件）
+static vector<float> random_div(int r, int c, int seed, const unsigned char* solid = nullptr, bool zero_mean = false) {
+    vector<float> div(r * c, 0.f);
+    double sum = 0;
+    int cells = 0;
+    for (int j = 1; j < c - 1; j++) {
+        for (int i = 1; i < r - 1; i++) {
+            int k = j * r + i;
+            if (solid && solid[k]) continue;
+            div[k] = hash_random(hash_combine(seed, k), -1.f, 1.f);
+            sum += div[k];
+            cells++;
+        }
+    }
+    if (zero_mean) {
+        for (int j = 1; j < c - 1; j++) {
+            for (int i = 1; i < r - 1; i++) {
+                int k = j * r + i;
+                if (!(solid && solid[k])) div[k] -= float(sum / cells);
+            }
+        }
+    }
+    return div;
+}
+
+// 四周都是墙（墙系数 1）的空盒子里 DCT 直接求解，一次即得到（浮点误差内的）精确解
+TEST_CASE(dct_solves_closed_box) {
+    const int r = 66, c = 50;
+    unique_ptr<PressureSolver> solver(PressureSolver::create(PRESSURE_DCT));
+    solver->init(r, c, 1.f);
+    vector<float> div = random_div(r, c, 1, nullptr, true);
+    vector<float> p(r * c, 0.f);
+    float before = solver->residual(p.data(), div.data());
+    solver->solve(p.data(), div.data(), 1, 0.f);
+    float after = solver->residual(p.data(), div.data());
+    expect(after <= 1e-4f * before, "DCT residual " + to_string(after) + " on a closed box, " + to_string(before) + " before");
+}
+
+// 大网格上分块的 gridJacobiSweeps 与逐次整网格的 gridJacobi + gridBoundary 逐位相同，串行与线程池上都是
+TEST_CASE(blocked_jacobi_sweeps_match_plain) {
+    const int r = 402, c = 402;
+    expect(r * c >= GRID_BLOCK_MIN_CELLS, "grid too small to be blocked");
+    const float walls[4] = { 1.f, 0.f, 0.5f, 1.f };
+    const float a = 1.f, cf = 0.25f;
+    vector<float> rhs = random_div(r, c, 2);
+    vector<float> init(r * c);
+    for (int k = 0; k < r * c; k++) init[k] = hash_random(hash_combine(3, k), -1.f, 1.f);
+
+    Parallel pool;
+    for (int sweeps : { 1, 3, GRID_BLOCK_SWEEPS, 2 * GRID_BLOCK_SWEEPS + 1 }) {
+        vector<float> plain = init, plainTmp(r * c);
+        for (int s = 0; s < sweeps; s++) {
+            gridJacobi(plainTmp.data(), plain.data(), rhs.data(), -1.f, a, cf, r, c);
+            gridBoundary(plainTmp.data(), r, c, walls);
+            plain.swap(plainTmp);
+        }
+        for (Parallel* p : { (Parallel*)nullptr, &pool }) {
+            vector<float> blocked = init, tmp(r * c), scratch;
+            gridJacobiSweeps(blocked.data(), tmp.data(), rhs.data(), -1.f, a, cf, walls, r, c, sweeps, scratch, p);
+            expect(blocked == plain, to_string(sweeps) + " blocked sweeps differ from plain ones" + (p ? " on the pool" : ""));
+        }
+    }
+}
+
+// 带固体掩码（一道不完整的隔墙与一个封闭的空腔）时，各迭代求解器都使残差显著下降
+TEST_CASE(masked_residual_falls) {
+    const int r = 66, c = 50;
+    vector<unsigned char> solid(r * c, 0);
+    for (int j = 1; j < c - 12; j++) {
+        for (int i = 30; i < 33; i++) solid[j * r + i] = 1;
+    }
+    // 边长为 10 的方框，内部的流体与外界隔绝
+    for (int j = 30; j < 40; j++) {
+        for (int i = 45; i < 55; i++) {
+            if (j == 30 || j == 39 || i == 45 || i == 54) solid[j * r + i] = 1;
+        }
+    }
+    vector<float> div = random_div(r, c, 4, solid.data());
+
+    struct Case {
+        PressureSolverType type;
+        const char* name;
+        int iterations;
+        float reduction; // 残差至少降到初始的这一比例
+    };
+    for (Case cs : { Case{ PRESSURE_JACOBI, "Jacobi", 200, 0.2f }, Case{ PRESSURE_MULTIGRID, "multigrid", 20, 1e-3f },
+            Case{ PRESSURE_PCG, "PCG", 60, 1e-3f } }) {
+        const float walls[4] = { 0.f, 0.f, 1.f, 1.f };
+        unique_ptr<PressureSolver> solver(PressureSolver::create(cs.type));
+        solver->init(r, c, walls);
+        solver->setSolid(solid.data());
+        vector<float> p(r * c, 0.f);
+        float before = solver->residual(p.data(), div.data());
+        solver->solve(p.data(), div.data(), cs.iterations, 0.f);
+        float after = solver->residual(p.data(), div.data());
+        expect(after <= cs.reduction * before,
+            string(cs.name) + " residual " + to_string(after) + " under a solid mask, " + to_string(before) + " before");
+    }
+}
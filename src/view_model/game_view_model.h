@@ -3,7 +3,12 @@
 #include "../common/particle.h"
 #include "../common/parameter.h"
 #include "../common/timer.h"
+#include "../common/triple_buffer.h"
 #include "../model/game_model.h"
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
 
 namespace Simflow {
     using namespace std;
@@ -14,6 +19,14 @@ namespace Simflow {
 
         vector<ParticleInfo> data_buffer;
 
+        // ̬岻УתΪӽView
+        void append_solids(vector<ParticleInfo>& out) {
+            auto solids = model->query_solids();
+            for (int im : solids.cells) {
+                out.push_back(ParticleInfo{ ParticleType::Iron, vec2(im % width, im / width), solids.temperature[im] });
+            }
+        }
+
         void trigger_frame_ready() {
 
             data_buffer.clear();
@@ -21,20 +34,147 @@ namespace Simflow {
             for (int i = 0; i < result.position.size(); i++) {
                 data_buffer.push_back(ParticleInfo{ result.type[i], result.position[i], result.temperature[i] });
             }
+            append_solids(data_buffer);
 
             auto& pressure = model->query_pressure();
             event_frame_ready.trigger(FrameData{ data_buffer, pressure });
         }
 
+#pragma region ˮģʽ
+
+        // ģ߳ɵһ֡
+        struct FrameSnapshot {
+            vector<ParticleType> type;
+            vector<vec2> position;
+            vector<vec2> movement;
+            vector<float> temperature;
+            vector<ParticleInfo> solids;
+            Array2D<float> pressure;
+            chrono::steady_clock::time_point published;
+            FrameSnapshot() : pressure(height, width) {}
+        };
+
+        TripleBuffer<FrameSnapshot> snapshots;
+        thread sim_thread;
+        atomic<bool> pipelined = false;
+        atomic<bool> sim_stop = false;
+        float sim_interval_ms = 1000.f / 60;
+
+        // ˮģʽViewĻݴ棬ģ߳һ֡ʼǰModel
+        mutex brush_mutex;
+        bool has_particle_brush = false, has_heat_brush = false;
+        ParticleBrush pending_particle_brush;
+        HeatBrush pending_heat_brush;
+
+        void apply_pending_brushes() {
+            lock_guard lg(brush_mutex);
+            if (has_particle_brush) model->set_new_particles(pending_particle_brush);
+            if (has_heat_brush) model->set_heat(pending_heat_brush);
+            has_particle_brush = has_heat_brush = false;
+        }
+
+        void publish_snapshot() {
+            FrameSnapshot& snap = *snapshots.write_buffer();
+            auto result = model->query_particles();
+            snap.type = result.type;
+            snap.position = result.position;
+            snap.movement = result.movement;
+            snap.temperature = result.temperature;
+            snap.solids.clear();
+            append_solids(snap.solids);
+            auto& pressure = model->query_pressure();
+            for (int j = 0; j < height; j++) {
+                for (int i = 0; i < width; i++) {
+                    snap.pressure[j][i] = pressure[j][i];
+                }
+            }
+            snap.published = chrono::steady_clock::now();
+            snapshots.publish();
+        }
+
+        // ģ̣߳Թ̶ƽModelÿ֡дػ
+        void sim_loop() {
+            auto interval = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<float, milli>(sim_interval_ms));
+            auto next_tick = chrono::steady_clock::now();
+            while (!sim_stop) {
+                apply_pending_brushes();
+                model->update();
+                publish_snapshot();
+
+                next_tick += interval;
+                auto now = chrono::steady_clock::now();
+                if (next_tick < now) {
+                    // ģʱ׷֡ӵǰʱ¼ʱ
+                    next_tick = now;
+                }
+                else {
+                    this_thread::sleep_until(next_tick);
+                }
+            }
+        }
+
+        // ɵһ֡interpolate Ϊ true ʱݱ֡λһ֡뱾ֵ֮֡
+        void trigger_latest_frame() {
+            FrameSnapshot& snap = *snapshots.read_buffer();
+            float alpha = 1;
+            if (interpolate) {
+                float elapsed = chrono::duration<float, milli>(chrono::steady_clock::now() - snap.published).count();
+                alpha = clamp(elapsed / sim_interval_ms, 0.f, 1.f);
+            }
+
+            data_buffer.clear();
+            for (int i = 0; i < snap.position.size(); i++) {
+                vec2 pos = snap.position[i] - snap.movement[i] * (1 - alpha);
+                data_buffer.push_back(ParticleInfo{ snap.type[i], pos, snap.temperature[i] });
+            }
+            data_buffer.insert(data_buffer.end(), snap.solids.begin(), snap.solids.end());
+            event_frame_ready.trigger(FrameData{ data_buffer, snap.pressure });
+        }
+
+#pragma endregion
+
     public:
 
         GameViewModel(GameModel<width, height> * model) : model(model) {}
 
+        ~GameViewModel() {
+            stop_pipeline();
+        }
+
+        // Ƿ֡ģֵ֮λãˮģʽ
+        bool interpolate = true;
+
+        // ˮģʽModelڶ߳ interval_ms Ĺ̶£
+        // Viewÿˢֻɵһ֡N+1֡ģN֡Ļͬʱ
+        void start_pipeline(float interval_ms = 1000.f / 60) {
+            if (pipelined) return;
+            sim_interval_ms = interval_ms;
+            // ģһ֡һ¼ɣʱͼ
+            model->frame_budget_ms = interval_ms;
+            sim_stop = false;
+            publish_snapshot();
+            pipelined = true;
+            sim_thread = thread([this]() { sim_loop(); });
+        }
+
+        void stop_pipeline() {
+            if (!pipelined) return;
+            sim_stop = true;
+            if (sim_thread.joinable()) sim_thread.join();
+            model->frame_budget_ms = 0;
+            pipelined = false;
+        }
+
         EventSource<FrameData> event_frame_ready;
 
         // ¼View֪ͨViewModel߼£
         shared_ptr<EventHandler<>> on_update = function_handler(function(
             [this]() {
+            if (this->pipelined) {
+                this->trigger_latest_frame();
+                return;
+            }
+
             this->model->update();
             // TODO: Ƴϵ¼
             Timer t;
@@ -50,14 +190,26 @@ namespace Simflow {
         // ¼View֪ͨViewModelӣ
         shared_ptr<EventHandler<ParticleBrush>> on_new_particles = function_handler(function(
             [this](ParticleBrush brush) {
+            if (this->pipelined) {
+                lock_guard lg(this->brush_mutex);
+                this->pending_particle_brush = brush;
+                this->has_particle_brush = true;
+                return;
+            }
             this->model->set_new_particles(brush);
         }));
 
         // ı¶¼
         shared_ptr<EventHandler<HeatBrush>> on_change_heat = function_handler(function(
             [this](HeatBrush brush) {
+            if (this->pipelined) {
+                lock_guard lg(this->brush_mutex);
+                this->pending_heat_brush = brush;
+                this->has_heat_brush = true;
+                return;
+            }
             this->model->set_heat(brush);
         }));
     };
 
-}
\ No newline at end of file
+}
@@ -64,6 +64,11 @@ int main() {
             }
             my3d::present::set_pixel(pos.x, pos.y, cc2);
         }
+        const auto& solids = gm.query_solids();
+        for (int im : solids.cells) {
+            my3d::Color cc2 = { 255,0,0 };
+            my3d::present::set_pixel(im % msize, im / msize, cc2);
+        }
 
         my3d::present::present();
         i++;